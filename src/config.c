@@ -2,10 +2,14 @@
  * viod - SR-IOV Virtual Function daemon
  * 
  * Configuration file parsing implementation
- * Handles INI-style configuration files with [pf] and [vfN] sections.
+ * Handles INI-style configuration files with [pf], [vfN] and [profile.NAME] sections.
  */
 #include "viod.h"
 #include <ctype.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
 
 /**
  * Remove leading and trailing whitespace from a string in-place
@@ -42,6 +46,200 @@ static device_kind_t parse_device_kind(const char *kind_str) {
     return DEVICE_KIND_DEV; /* Default fallback */
 }
 
+/**
+ * Parse VF link state string (auto, enable, disable)
+ * Returns corresponding vf_link_state_t, VF_LINK_STATE_UNSET for unknown values
+ */
+static vf_link_state_t parse_link_state(const char *state_str) {
+    if (strcmp(state_str, "auto") == 0) {
+        return VF_LINK_STATE_AUTO;
+    } else if (strcmp(state_str, "enable") == 0) {
+        return VF_LINK_STATE_ENABLE;
+    } else if (strcmp(state_str, "disable") == 0) {
+        return VF_LINK_STATE_DISABLE;
+    }
+    log_message(LOG_WARNING, "Unknown link_state '%s', leaving link state unchanged", state_str);
+    return VF_LINK_STATE_UNSET;
+}
+
+/**
+ * Get the configuration keyword for a VF link state
+ */
+const char *vf_link_state_name(vf_link_state_t state) {
+    switch (state) {
+        case VF_LINK_STATE_AUTO:    return "auto";
+        case VF_LINK_STATE_ENABLE:  return "enable";
+        case VF_LINK_STATE_DISABLE: return "disable";
+        default:                    return "unset";
+    }
+}
+
+/**
+ * Parse a per-VF on/off setting (on, yes, off, no)
+ * Returns corresponding vf_flag_t, VF_FLAG_UNSET for unknown values
+ */
+static vf_flag_t parse_vf_flag(const char *key, const char *value) {
+    if (strcmp(value, "on") == 0 || strcmp(value, "yes") == 0) {
+        return VF_FLAG_ON;
+    } else if (strcmp(value, "off") == 0 || strcmp(value, "no") == 0) {
+        return VF_FLAG_OFF;
+    }
+    log_message(LOG_WARNING, "Unknown %s '%s', leaving it unchanged", key, value);
+    return VF_FLAG_UNSET;
+}
+
+/**
+ * Get the configuration keyword for a per-VF on/off setting
+ */
+const char *vf_flag_name(vf_flag_t flag) {
+    switch (flag) {
+        case VF_FLAG_ON:  return "on";
+        case VF_FLAG_OFF: return "off";
+        default:          return "unset";
+    }
+}
+
+/**
+ * Parse VF VLAN protocol string (802.1Q, 802.1ad)
+ * Returns the ethertype, 0 (kernel default 802.1Q) for unknown values
+ */
+static int parse_vlan_proto(const char *proto_str) {
+    if (strcasecmp(proto_str, "802.1Q") == 0) {
+        return ETH_P_8021Q;
+    } else if (strcasecmp(proto_str, "802.1ad") == 0) {
+        return ETH_P_8021AD;
+    }
+    log_message(LOG_WARNING, "Unknown vlan_proto '%s', using 802.1Q", proto_str);
+    return 0;
+}
+
+/**
+ * Parse a hugepage size (2M, 1G, or a size in kB such as 2048k)
+ * Returns the size in kB, 0 for invalid values
+ */
+static int parse_hugepage_size(const char *size_str) {
+    char *end;
+    long size = strtol(size_str, &end, 10);
+
+    if (size <= 0) {
+        return 0;
+    }
+    switch (*end) {
+        case 'k': case 'K': return (int)size;
+        case 'M': case 'm': return (int)(size * 1024);
+        case 'G': case 'g': return (int)(size * 1024 * 1024);
+        default:            return 0;
+    }
+}
+
+/**
+ * Check a netdev name the way the kernel does (dev_valid_name)
+ */
+static int valid_ifname(const char *name) {
+    if (name[0] == '\0' || strlen(name) >= IFNAMSIZ ||
+        strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        return 0;
+    }
+    for (; *name; name++) {
+        if (*name == '/' || *name == ':' || isspace((unsigned char)*name)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Check a netns value: a pid, a /run/netns name or an absolute path
+ */
+static int valid_netns(const char *netns) {
+    if (netns[0] == '/') {
+        return 1;
+    }
+    if (strspn(netns, "0123456789") == strlen(netns)) {
+        errno = 0;
+        long pid = strtol(netns, NULL, 10);
+        return errno == 0 && pid > 0 && pid <= INT_MAX;
+    }
+    return strchr(netns, '/') == NULL && strcmp(netns, ".") != 0 && strcmp(netns, "..") != 0;
+}
+
+/**
+ * Parse a GPU resource key shared by [profile.NAME] and [vfN] sections
+ * lmem_quota accepts K, M and G suffixes.
+ * Returns 1 if key is a GPU resource, 0 otherwise
+ */
+static int parse_gpu_resource(gpu_profile_t *gpu, const char *key, const char *value) {
+    if (strcmp(key, "lmem_quota") == 0) {
+        char *end;
+        long long quota = strtoll(value, &end, 10);
+        switch (*end) {
+            case 'K': case 'k': quota <<= 10; break;
+            case 'M': case 'm': quota <<= 20; break;
+            case 'G': case 'g': quota <<= 30; break;
+        }
+        gpu->lmem_quota = quota;
+    } else if (strcmp(key, "exec_quantum_ms") == 0) {
+        gpu->exec_quantum_ms = atoi(value);
+    } else if (strcmp(key, "preempt_timeout_us") == 0) {
+        gpu->preempt_timeout_us = atoi(value);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+static void gpu_profile_init(gpu_profile_t *gpu) {
+    memset(gpu, 0, sizeof(*gpu));
+    gpu->lmem_quota = -1;
+    gpu->exec_quantum_ms = -1;
+    gpu->preempt_timeout_us = -1;
+}
+
+/**
+ * Fill the GPU resources a VF does not set explicitly from its named profile
+ * Returns 0 on success, -1 if the profile is not defined in the file
+ */
+static int resolve_gpu_profile(vf_config_t *vf, const gpu_profile_t *profiles, int count) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(profiles[i].name, vf->gpu.name) != 0) continue;
+        
+        if (vf->gpu.lmem_quota < 0) vf->gpu.lmem_quota = profiles[i].lmem_quota;
+        if (vf->gpu.exec_quantum_ms < 0) vf->gpu.exec_quantum_ms = profiles[i].exec_quantum_ms;
+        if (vf->gpu.preempt_timeout_us < 0) vf->gpu.preempt_timeout_us = profiles[i].preempt_timeout_us;
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * Parse a "vendor:device" PCI ID selector; either half may be "*"
+ * Returns 0 on success, -1 on invalid format
+ */
+static int parse_pci_id(const char *value, pf_selector_t *match) {
+    char vendor[16], device[16];
+
+    if (sscanf(value, "%15[^:]:%15s", vendor, device) != 2) {
+        return -1;
+    }
+    match->vendor = strcmp(vendor, "*") == 0 ? -1 : (int)strtol(vendor, NULL, 16);
+    match->device = strcmp(device, "*") == 0 ? -1 : (int)strtol(device, NULL, 16);
+    return 0;
+}
+
+/**
+ * Check whether a probed PF satisfies every selector of a template
+ */
+static int selector_matches(const pf_config_t *config, const pf_caps_t *pf) {
+    const pf_selector_t *match = &config->match;
+
+    if (config->name[0] && fnmatch(config->name, pf->pci_addr, 0) != 0) return 0;
+    if (match->vendor >= 0 && (unsigned int)match->vendor != pf->vendor) return 0;
+    if (match->device >= 0 && (unsigned int)match->device != pf->device) return 0;
+    if (match->driver[0] && fnmatch(match->driver, pf->driver, 0) != 0) return 0;
+    if (match->ifname[0] && fnmatch(match->ifname, pf->ifname, 0) != 0) return 0;
+    return 1;
+}
+
 /**
  * Parse section header like [pf] or [vf0]
  * Returns 1 if line is a section header, 0 otherwise
@@ -99,10 +297,22 @@ int parse_config_file(const char *filename, pf_config_t *config) {
     char section[MAX_NAME_LEN] = "";
     char key[MAX_NAME_LEN], value[MAX_NAME_LEN];
     int current_vf = -1;
+    gpu_profile_t profiles[MAX_GPU_PROFILES];
+    int profile_count = 0;
+    gpu_profile_t *current_profile = NULL;
+    int valid = 1;
     
     // Initialize config
     memset(config, 0, sizeof(pf_config_t));
     strncpy(config->config_file, filename, MAX_NAME_LEN - 1);
+    config->match.vendor = -1;
+    config->match.device = -1;
+    config->hugepage_kb = 2048;
+    for (int i = 0; i < MAX_VFS; i++) {
+        /* VFs without a [vfN] section still need their index */
+        config->vfs[i].id = i;
+        gpu_profile_init(&config->vfs[i].gpu);
+    }
     
     while (fgets(line, sizeof(line), file)) {
         // Remove newline
@@ -116,13 +326,20 @@ int parse_config_file(const char *filename, pf_config_t *config) {
         
         // Parse section headers
         if (parse_section(trimmed, section)) {
+            current_profile = NULL;
             if (strcmp(section, "pf") == 0) {
                 current_vf = -1;
+            } else if (strncmp(section, "profile.", 8) == 0) {
+                current_vf = -2;
+                if (profile_count < MAX_GPU_PROFILES) {
+                    current_profile = &profiles[profile_count++];
+                    gpu_profile_init(current_profile);
+                    strncpy(current_profile->name, section + 8, sizeof(current_profile->name) - 1);
+                } else {
+                    log_message(LOG_WARNING, "Too many profiles in %s, ignoring [%s]", filename, section);
+                }
             } else if (strncmp(section, "vf", 2) == 0) {
                 current_vf = atoi(section + 2);
-                if (current_vf >= 0 && current_vf < MAX_VFS) {
-                    config->vfs[current_vf].id = current_vf;
-                }
             }
             continue;
         }
@@ -132,16 +349,49 @@ int parse_config_file(const char *filename, pf_config_t *config) {
             continue;
         }
         
-        if (current_vf == -1) {
+        if (current_profile) {
+            // GPU resource profile section
+            if (!parse_gpu_resource(current_profile, key, value)) {
+                log_message(LOG_WARNING, "Unknown profile key '%s' in %s", key, filename);
+            }
+        } else if (current_vf == -1) {
             // PF section
             if (strcmp(key, "name") == 0) {
                 strncpy(config->name, value, MAX_NAME_LEN - 1);
             } else if (strcmp(key, "kind") == 0) {
                 config->kind = parse_device_kind(value);
             } else if (strcmp(key, "vfs") == 0) {
-                config->num_vfs = atoi(value);
+                char *end;
+                long vfs = strtol(value, &end, 10);
+                if (end == value || *end != '\0' || vfs < 0 || vfs > MAX_VFS) {
+                    log_message(LOG_ERR, "Invalid vfs '%s' in %s (0-%d)", value, filename, MAX_VFS);
+                    valid = 0;
+                } else {
+                    config->num_vfs = (int)vfs;
+                }
             } else if (strcmp(key, "promisc") == 0) {
                 config->promisc = (strcmp(value, "on") == 0 || strcmp(value, "yes") == 0);
+            } else if (strcmp(key, "mtu") == 0) {
+                config->mtu = atoi(value);
+            } else if (strcmp(key, "hugepages") == 0) {
+                config->hugepages = atoi(value);
+            } else if (strcmp(key, "hugepage_size") == 0) {
+                config->hugepage_kb = parse_hugepage_size(value);
+                if (config->hugepage_kb == 0) {
+                    log_message(LOG_WARNING, "Invalid hugepage_size '%s' in %s", value, filename);
+                }
+            } else if (strcmp(key, "match_id") == 0) {
+                if (parse_pci_id(value, &config->match) == 0) {
+                    config->match.enabled = 1;
+                } else {
+                    log_message(LOG_WARNING, "Invalid match_id '%s' in %s", value, filename);
+                }
+            } else if (strcmp(key, "match_driver") == 0) {
+                strncpy(config->match.driver, value, sizeof(config->match.driver) - 1);
+                config->match.enabled = 1;
+            } else if (strcmp(key, "match_ifname") == 0) {
+                strncpy(config->match.ifname, value, sizeof(config->match.ifname) - 1);
+                config->match.enabled = 1;
             }
         } else if (current_vf >= 0 && current_vf < MAX_VFS) {
             // VF section
@@ -152,72 +402,296 @@ int parse_config_file(const char *filename, pf_config_t *config) {
                 strncpy(vf->mac, value, 17);
             } else if (strcmp(key, "vlan") == 0) {
                 vf->vlan = atoi(value);
+            } else if (strcmp(key, "vlan_qos") == 0) {
+                vf->vlan_qos = atoi(value);
+            } else if (strcmp(key, "vlan_proto") == 0) {
+                vf->vlan_proto = parse_vlan_proto(value);
+            } else if (strcmp(key, "link_state") == 0) {
+                vf->link_state = parse_link_state(value);
+            } else if (strcmp(key, "mtu") == 0) {
+                vf->mtu = atoi(value);
+            } else if (strcmp(key, "trust") == 0) {
+                vf->trust = parse_vf_flag(key, value);
+            } else if (strcmp(key, "spoofchk") == 0) {
+                vf->spoofchk = parse_vf_flag(key, value);
+            } else if (strcmp(key, "query_rss") == 0) {
+                vf->query_rss = parse_vf_flag(key, value);
+            } else if (strcmp(key, "netns") == 0) {
+                if (value[0] && !valid_netns(value)) {
+                    log_message(LOG_WARNING, "Invalid netns '%s' in %s (pid, name or path), ignoring",
+                               value, filename);
+                } else {
+                    strncpy(vf->netns, value, MAX_NAME_LEN - 1);
+                }
+            } else if (strcmp(key, "ifname") == 0) {
+                if (value[0] && !valid_ifname(value)) {
+                    log_message(LOG_WARNING, "Invalid ifname '%s' in %s, ignoring", value, filename);
+                } else {
+                    strncpy(vf->ifname, value, sizeof(vf->ifname) - 1);
+                }
+            } else if (strcmp(key, "profile") == 0) {
+                strncpy(vf->gpu.name, value, sizeof(vf->gpu.name) - 1);
+            } else {
+                parse_gpu_resource(&vf->gpu, key, value);
             }
         }
     }
     
     fclose(file);
     
-    log_message(LOG_INFO, "Parsed config %s: PF=%s, kind=%d, vfs=%d", 
-               filename, config->name, config->kind, config->num_vfs);
+    /* A wrong VF count must not reach the teardown, so drop the whole file */
+    if (!valid) {
+        return -1;
+    }
+    
+    /* Profiles may be defined after the VFs that use them */
+    for (int i = 0; i < MAX_VFS; i++) {
+        vf_config_t *vf = &config->vfs[i];
+        if (vf->gpu.name[0] && resolve_gpu_profile(vf, profiles, profile_count) != 0) {
+            log_message(LOG_ERR, "VF %d in %s uses undefined profile '%s'", i, filename, vf->gpu.name);
+            return -1;
+        }
+    }
+    
+    /* A glob in the name also makes this section a template */
+    if (strpbrk(config->name, "*?[")) {
+        config->match.enabled = 1;
+    }
+    
+    /* Use the full PCI address form everywhere past parsing */
+    char pci_addr[MAX_NAME_LEN];
+    if (config->name[0] || !config->match.enabled) {
+        if (normalize_pci_address(config->name, pci_addr, sizeof(pci_addr)) != 0) {
+            log_message(LOG_ERR, "Invalid PF address '%s' in %s", config->name, filename);
+            return -1;
+        }
+        strncpy(config->name, pci_addr, MAX_NAME_LEN - 1);
+    }
+    
+    log_message(LOG_INFO, "Parsed config %s: PF=%s%s, kind=%d, vfs=%d", 
+               filename, config->name[0] ? config->name : "*",
+               config->match.enabled ? " (template)" : "", config->kind, config->num_vfs);
     
     return 0;
 }
 
+/**
+ * Parse a MAC prefix of 1 to MAX_MAC_PREFIX octets such as 0a:5e
+ * Returns the number of octets, -1 if invalid or a multicast prefix
+ */
+static int parse_mac_prefix(const char *value, unsigned char *prefix) {
+    int count = 0;
+    
+    while (count < MAX_MAC_PREFIX) {
+        char *end;
+        unsigned long octet = strtoul(value, &end, 16);
+        if (end == value || end - value > 2 || octet > 0xff) {
+            return -1;
+        }
+        prefix[count++] = (unsigned char)octet;
+        if (*end == '\0') {
+            /* Generated MACs must stay unicast */
+            return (prefix[0] & 0x01) ? -1 : count;
+        }
+        if (*end != ':') {
+            return -1;
+        }
+        value = end + 1;
+    }
+    return -1;
+}
+
+/**
+ * Load host-wide settings from SITE_CONFIG_PATH
+ * A missing file keeps the defaults: no salt and the 02 prefix. An invalid
+ * setting is logged and ignored, like an unknown key.
+ * Returns 0 on success, -1 if the file cannot be read
+ */
+static int load_site_config(site_config_t *site) {
+    char line[MAX_LINE_LEN];
+    char key[MAX_NAME_LEN], value[MAX_NAME_LEN];
+    
+    memset(site, 0, sizeof(*site));
+    site->mac_prefix[0] = 0x02;
+    site->mac_prefix_len = 1;
+    
+    FILE *file = fopen(SITE_CONFIG_PATH, "r");
+    if (!file) {
+        if (errno != ENOENT) {
+            log_message(LOG_ERR, "Cannot open %s: %s", SITE_CONFIG_PATH, strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+    
+    while (fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\n")] = 0;
+        
+        char *trimmed = trim_whitespace(line);
+        if (strlen(trimmed) == 0 || trimmed[0] == '#') {
+            continue;
+        }
+        if (!parse_key_value(trimmed, key, value)) {
+            continue;
+        }
+        
+        if (strcmp(key, "mac_salt") == 0) {
+            strncpy(site->mac_salt, value, sizeof(site->mac_salt) - 1);
+        } else if (strcmp(key, "mac_prefix") == 0) {
+            unsigned char prefix[MAX_MAC_PREFIX];
+            int len = parse_mac_prefix(value, prefix);
+            if (len < 0) {
+                log_message(LOG_ERR, "Invalid mac_prefix '%s' in %s (1-%d unicast octets), using 02",
+                           value, SITE_CONFIG_PATH, MAX_MAC_PREFIX);
+                site->mac_prefix[0] = 0x02;
+                site->mac_prefix_len = 1;
+            } else {
+                memcpy(site->mac_prefix, prefix, len);
+                site->mac_prefix_len = len;
+            }
+        } else {
+            log_message(LOG_WARNING, "Unknown site key '%s' in %s", key, SITE_CONFIG_PATH);
+        }
+    }
+    
+    fclose(file);
+    return 0;
+}
+
+/**
+ * Append a PF configuration to the list
+ * An explicit [pf] for a PF overrides a template that matched it; otherwise
+ * the first configuration for a PF (in file name order) wins.
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int add_config(config_list_t *configs, const pf_config_t *config) {
+    for (size_t i = 0; i < configs->count; i++) {
+        pf_config_t *existing = &configs->configs[i];
+        if (strcmp(existing->name, config->name) != 0) continue;
+        
+        if (existing->match.enabled && !config->match.enabled) {
+            log_message(LOG_INFO, "PF %s: %s overrides template %s", 
+                       config->name, config->config_file, existing->config_file);
+            *existing = *config;
+        } else {
+            log_message(LOG_WARNING, "PF %s already configured by %s, ignoring %s", 
+                       config->name, existing->config_file, config->config_file);
+        }
+        return 0;
+    }
+    
+    /* Expand capacity if needed */
+    if (configs->count >= configs->capacity) {
+        size_t capacity = configs->capacity ? configs->capacity * 2 : 16;
+        pf_config_t *new_configs = realloc(configs->configs, capacity * sizeof(pf_config_t));
+        if (!new_configs) {
+            log_message(LOG_ERR, "Failed to reallocate memory for configurations");
+            return -1;
+        }
+        configs->configs = new_configs;
+        configs->capacity = capacity;
+    }
+    
+    configs->configs[configs->count++] = *config;
+    return 0;
+}
+
 /**
  * Load all .conf files from the configuration directory
+ * Files are processed in name order. Templates are expanded into one
+ * configuration per matching PF, using a single PCI scan per load.
  * Returns 0 on success, -1 on failure
  */
 int load_all_configs(config_list_t *configs) {
-    DIR *dir = opendir(CONFIG_DIR);
-    if (!dir) {
+    struct dirent **entries;
+    pf_caps_t *pfs = NULL;
+    size_t pf_count = 0;
+    int scanned = 0;
+    int result = 0;
+    
+    int n = scandir(CONFIG_DIR, &entries, NULL, alphasort);
+    if (n < 0) {
         log_message(LOG_ERR, "Cannot open config directory %s: %s", 
                    CONFIG_DIR, strerror(errno));
         return -1;
     }
     
     /* Initialize config list */
-    configs->capacity = 16;
-    configs->configs = malloc(configs->capacity * sizeof(pf_config_t));
-    if (!configs->configs) {
+    configs->configs = NULL;
+    configs->count = 0;
+    configs->capacity = 0;
+    
+    /* Too large for the stack with MAX_VFS VF entries */
+    pf_config_t *parsed = malloc(sizeof(pf_config_t));
+    if (!parsed) {
         log_message(LOG_ERR, "Failed to allocate memory for configurations");
-        closedir(dir);
-        return -1;
+        result = -1;
     }
-    configs->count = 0;
     
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
+    for (int e = 0; e < n && result == 0; e++) {
+        struct dirent *entry = entries[e];
         if (entry->d_type != DT_REG) continue;
         
         /* Check for .conf extension */
         char *ext = strrchr(entry->d_name, '.');
         if (!ext || strcmp(ext, ".conf") != 0) continue;
         
-        /* Expand capacity if needed */
-        if (configs->count >= configs->capacity) {
-            configs->capacity *= 2;
-            pf_config_t *new_configs = realloc(configs->configs, 
-                                              configs->capacity * sizeof(pf_config_t));
-            if (!new_configs) {
-                log_message(LOG_ERR, "Failed to reallocate memory for configurations");
-                closedir(dir);
-                return -1;
-            }
-            configs->configs = new_configs;
-        }
-        
         /* Parse config file */
         char filepath[512];
         snprintf(filepath, sizeof(filepath), "%s/%s", CONFIG_DIR, entry->d_name);
         
-        if (parse_config_file(filepath, &configs->configs[configs->count]) == 0) {
-            configs->count++;
+        int span = trace_begin("parse", "%s", filepath);
+        int parse_result = parse_config_file(filepath, parsed);
+        trace_end(span);
+        if (parse_result != 0) {
+            continue;
         }
+        
+        if (!parsed->match.enabled) {
+            result = add_config(configs, parsed);
+            continue;
+        }
+        
+        /* Template: expand into every matching PF */
+        if (!scanned) {
+            span = trace_begin("pci_scan", "%s", "/sys/bus/pci/devices");
+            pci_scan_pfs(&pfs, &pf_count);
+            trace_end(span);
+            scanned = 1;
+        }
+        
+        size_t matched = 0;
+        char pattern[MAX_NAME_LEN];
+        memcpy(pattern, parsed->name, sizeof(pattern));
+        for (size_t i = 0; i < pf_count && result == 0; i++) {
+            strncpy(parsed->name, pattern, MAX_NAME_LEN - 1);
+            if (!selector_matches(parsed, &pfs[i])) continue;
+            
+            strncpy(parsed->name, pfs[i].pci_addr, MAX_NAME_LEN - 1);
+            result = add_config(configs, parsed);
+            matched++;
+        }
+        log_message(LOG_INFO, "Template %s matched %zu PF(s)", filepath, matched);
     }
     
-    closedir(dir);
-    return 0;
+    /* Cross-check configured MACs and assign generated ones */
+    if (result == 0) {
+        site_config_t site;
+        result = load_site_config(&site);
+        if (result == 0) {
+            int span = trace_begin("mac_index", "%zu PF(s)", configs->count);
+            result = mac_index_build(configs, &site);
+            trace_end(span);
+        }
+    }
+    
+    for (int e = 0; e < n; e++) {
+        free(entries[e]);
+    }
+    free(entries);
+    free(parsed);
+    free(pfs);
+    return result;
 }
 
 /**
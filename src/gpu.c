@@ -0,0 +1,103 @@
+/**
+ * viod - SR-IOV Virtual Function daemon
+ *
+ * GPU VF provisioning implementation
+ * Writes per-VF resource quotas and scheduling parameters through the PF
+ * driver's provisioning interface after VFs are enabled and before a driver
+ * is bound to them:
+ *   - xe:   /sys/kernel/debug/dri/<pf>/gt<N>/vf<M>/<attr>
+ *   - i915: /sys/bus/pci/devices/<pf>/drm/card<N>/iov/vf<M>/gt<N>/<attr>
+ * VF numbers are 1-based in both (vf1 is VF index 0). Scheduling parameters
+ * are set on every GT; memory quotas only exist on GTs that own local memory.
+ */
+#include "viod.h"
+#include <glob.h>
+
+/* Where each supported driver exposes a VF attribute (%s PF, %d VF number, %s attribute) */
+static const char *const provisioning_paths[] = {
+    "/sys/kernel/debug/dri/%s/gt*/vf%d/%s",
+    "/sys/bus/pci/devices/%s/drm/card*/iov/vf%d/gt*/%s",
+};
+
+/**
+ * Check whether any GPU resource is set
+ */
+int gpu_profile_set(const gpu_profile_t *gpu) {
+    return gpu->lmem_quota >= 0 || gpu->exec_quantum_ms >= 0 || gpu->preempt_timeout_us >= 0;
+}
+
+/**
+ * Write a value to every GT instance of a VF provisioning attribute
+ * Returns the number of files written, or -1 if a write failed
+ */
+static int write_vf_attr(const char *pf_pci_addr, int vf_id, const char *attr, long long value) {
+    char pattern[512];
+    char buf[32];
+    int written = 0;
+
+    snprintf(buf, sizeof(buf), "%lld", value);
+
+    for (size_t p = 0; p < sizeof(provisioning_paths) / sizeof(provisioning_paths[0]); p++) {
+        glob_t paths;
+
+        snprintf(pattern, sizeof(pattern), provisioning_paths[p], pf_pci_addr, vf_id + 1, attr);
+        if (glob(pattern, 0, NULL, &paths) != 0) {
+            continue;
+        }
+
+        for (size_t i = 0; i < paths.gl_pathc; i++) {
+            int fd = open(paths.gl_pathv[i], O_WRONLY);
+            ssize_t len = strlen(buf);
+            if (fd < 0 || write(fd, buf, len) != len) {
+                log_message(LOG_ERR, "Cannot write %s to %s: %s", buf, paths.gl_pathv[i], strerror(errno));
+                if (fd >= 0) close(fd);
+                globfree(&paths);
+                return -1;
+            }
+            close(fd);
+            written++;
+        }
+        globfree(&paths);
+
+        /* Only one driver owns the PF */
+        if (written > 0) {
+            break;
+        }
+    }
+
+    return written;
+}
+
+/**
+ * Provision the resources of one GPU VF
+ * Returns 0 on success, -1 if the driver rejects a value or does not offer it
+ */
+int apply_gpu_profile(const char *pf_pci_addr, int vf_id, const gpu_profile_t *gpu) {
+    const struct {
+        const char *attr;
+        long long value;
+    } resources[] = {
+        { "lmem_quota", gpu->lmem_quota },
+        { "exec_quantum_ms", gpu->exec_quantum_ms },
+        { "preempt_timeout_us", gpu->preempt_timeout_us },
+    };
+
+    for (size_t i = 0; i < sizeof(resources) / sizeof(resources[0]); i++) {
+        if (resources[i].value < 0) continue;
+
+        int written = write_vf_attr(pf_pci_addr, vf_id, resources[i].attr, resources[i].value);
+        if (written < 0) {
+            return -1;
+        }
+        if (written == 0) {
+            log_message(LOG_ERR, "PF %s offers no %s for VF %d (driver without SR-IOV provisioning?)",
+                       pf_pci_addr, resources[i].attr, vf_id);
+            return -1;
+        }
+    }
+
+    log_message(LOG_INFO, "Provisioned VF %d on %s%s%s: lmem_quota=%lld exec_quantum_ms=%d preempt_timeout_us=%d",
+               vf_id, pf_pci_addr, gpu->name[0] ? " with profile " : "", gpu->name,
+               gpu->lmem_quota, gpu->exec_quantum_ms, gpu->preempt_timeout_us);
+    return 0;
+}
@@ -0,0 +1,241 @@
+/**
+ * viod - SR-IOV Virtual Function daemon
+ *
+ * Shared-memory VF inventory implementation
+ * Publishes applied VFs to INVENTORY_PATH for syscall-free lookups by local consumers.
+ * viod is the only writer; all updates happen inside a sequence lock write section.
+ */
+#include "viod.h"
+#include <sys/mman.h>
+
+static inventory_t *inventory = NULL;
+
+/**
+ * Enter a write section: readers will retry until inventory_write_end()
+ */
+static void inventory_write_begin(void) {
+    __atomic_store_n(&inventory->seq, inventory->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Leave a write section and publish the update
+ */
+static void inventory_write_end(void) {
+    inventory->generation++;
+    __atomic_store_n(&inventory->seq, inventory->seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Read the ifindex of the netdev backing a PCI device
+ * Returns ifindex, or 0 if the device has no netdev in this namespace
+ */
+static int read_pci_ifindex(const char *pci_addr) {
+    char ifname[64];
+    char path[512];
+
+    if (get_pci_interface(pci_addr, ifname, sizeof(ifname)) != 0) {
+        return 0;
+    }
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/ifindex", ifname);
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+
+    int ifindex = 0;
+    if (fscanf(file, "%d", &ifindex) != 1) {
+        ifindex = 0;
+    }
+    fclose(file);
+    return ifindex;
+}
+
+/**
+ * Read the name of the driver bound to a PCI device
+ * Leaves driver empty if no driver is bound
+ */
+static void read_pci_driver(const char *pci_addr, char *driver, size_t size) {
+    char path[512];
+    char target[512];
+
+    driver[0] = '\0';
+    snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/driver", pci_addr);
+
+    ssize_t len = readlink(path, target, sizeof(target) - 1);
+    if (len <= 0) {
+        return;
+    }
+    target[len] = '\0';
+
+    char *name = strrchr(target, '/');
+    strncpy(driver, name ? name + 1 : target, size - 1);
+    driver[size - 1] = '\0';
+}
+
+/**
+ * Create (or reset) the inventory file and map it shared
+ * Returns 0 on success, -1 on failure
+ */
+int inventory_open(void) {
+    if (mkdir(RUNTIME_DIR, 0755) != 0 && errno != EEXIST) {
+        log_message(LOG_ERR, "Failed to create %s: %s", RUNTIME_DIR, strerror(errno));
+        return -1;
+    }
+
+    int fd = open(INVENTORY_PATH, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_message(LOG_ERR, "Cannot open %s: %s", INVENTORY_PATH, strerror(errno));
+        return -1;
+    }
+
+    if (ftruncate(fd, sizeof(inventory_t)) != 0) {
+        log_message(LOG_ERR, "Cannot size %s: %s", INVENTORY_PATH, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, sizeof(inventory_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_message(LOG_ERR, "Cannot map %s: %s", INVENTORY_PATH, strerror(errno));
+        return -1;
+    }
+    inventory = map;
+
+    /* Keep a table left by viod --oneshot; entries of PFs that are not
+     * adopted are dropped later with inventory_retain() */
+    if (inventory->magic == INVENTORY_MAGIC && inventory->version == INVENTORY_VERSION &&
+        inventory->count <= INVENTORY_MAX_ENTRIES && !(inventory->seq & 1)) {
+        log_message(LOG_INFO, "Publishing VF inventory at %s (kept %u entries)",
+                   INVENTORY_PATH, inventory->count);
+        return 0;
+    }
+
+    /* Start from an empty table; the first reconcile repopulates it. A viod
+     * that died inside a write section left seq odd, so make it even first or
+     * write_begin() would publish the reset as a completed update. */
+    inventory->seq &= ~1u;
+    inventory_write_begin();
+    inventory->version = INVENTORY_VERSION;
+    inventory->count = 0;
+    memset(inventory->entries, 0, sizeof(inventory->entries));
+    inventory_write_end();
+    __atomic_store_n(&inventory->magic, INVENTORY_MAGIC, __ATOMIC_RELEASE);
+
+    log_message(LOG_INFO, "Publishing VF inventory at %s", INVENTORY_PATH);
+    return 0;
+}
+
+/**
+ * Unmap the inventory; the file is left in place for consumers
+ */
+void inventory_close(void) {
+    if (inventory) {
+        munmap(inventory, sizeof(inventory_t));
+        inventory = NULL;
+    }
+}
+
+/**
+ * Drop every entry belonging to a PF (its VFs are being recreated)
+ */
+void inventory_clear_pf(const char *pf_name) {
+    char pf_pci_addr[32];
+
+    if (!inventory || normalize_pci_address(pf_name, pf_pci_addr, sizeof(pf_pci_addr)) != 0) {
+        return;
+    }
+
+    inventory_write_begin();
+    uint32_t i = 0;
+    while (i < inventory->count) {
+        if (strcmp(inventory->entries[i].pf_pci_addr, pf_pci_addr) == 0) {
+            /* Keep the table dense: move the last entry into the hole */
+            inventory->count--;
+            inventory->entries[i] = inventory->entries[inventory->count];
+            memset(&inventory->entries[inventory->count], 0, sizeof(inventory_entry_t));
+        } else {
+            i++;
+        }
+    }
+    inventory_write_end();
+}
+
+/**
+ * Drop every entry whose PF the keep callback rejects
+ */
+void inventory_retain(int (*keep)(const char *pf_pci_addr)) {
+    if (!inventory) {
+        return;
+    }
+
+    inventory_write_begin();
+    uint32_t i = 0;
+    while (i < inventory->count) {
+        if (!keep(inventory->entries[i].pf_pci_addr)) {
+            inventory->count--;
+            inventory->entries[i] = inventory->entries[inventory->count];
+            memset(&inventory->entries[inventory->count], 0, sizeof(inventory_entry_t));
+        } else {
+            i++;
+        }
+    }
+    inventory_write_end();
+}
+
+/**
+ * Publish the applied state of one VF, replacing any previous entry
+ * All sysfs lookups are done before entering the write section.
+ */
+void inventory_update_vf(const pf_config_t *pf_config, const vf_config_t *vf_config,
+                         const char *mac, inventory_state_t state) {
+    inventory_entry_t entry;
+
+    if (!inventory) {
+        return;
+    }
+
+    memset(&entry, 0, sizeof(entry));
+    if (normalize_pci_address(pf_config->name, entry.pf_pci_addr, sizeof(entry.pf_pci_addr)) != 0) {
+        return;
+    }
+    entry.vf_id = vf_config->id;
+    entry.vlan = vf_config->vlan;
+    entry.state = state;
+    if (mac) {
+        strncpy(entry.mac, mac, sizeof(entry.mac) - 1);
+    }
+    entry.numa_node = -1;
+    entry.iommu_group = -1;
+    if (get_vf_pci_address(pf_config->name, vf_config->id,
+                           entry.vf_pci_addr, sizeof(entry.vf_pci_addr)) == 0) {
+        entry.ifindex = read_pci_ifindex(entry.vf_pci_addr);
+        entry.numa_node = pci_numa_node(entry.vf_pci_addr);
+        entry.iommu_group = pci_iommu_group(entry.vf_pci_addr);
+        read_pci_driver(entry.vf_pci_addr, entry.driver, sizeof(entry.driver));
+    }
+
+    inventory_write_begin();
+    uint32_t slot = inventory->count;
+    for (uint32_t i = 0; i < inventory->count; i++) {
+        if (inventory->entries[i].vf_id == entry.vf_id &&
+            strcmp(inventory->entries[i].pf_pci_addr, entry.pf_pci_addr) == 0) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < INVENTORY_MAX_ENTRIES) {
+        inventory->entries[slot] = entry;
+        if (slot == inventory->count) {
+            inventory->count++;
+        }
+    }
+    inventory_write_end();
+
+    if (slot >= INVENTORY_MAX_ENTRIES) {
+        log_message(LOG_WARNING, "VF inventory full, VF %d of %s not published",
+                   vf_config->id, pf_config->name);
+    }
+}
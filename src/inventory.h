@@ -0,0 +1,143 @@
+/**
+ * viod - SR-IOV Virtual Function daemon
+ *
+ * Shared-memory VF inventory layout
+ * viod publishes the VFs it has applied in a memory-mapped file so that local
+ * consumers (CNI plugins, device plugins, VM launchers) can look up a VF's
+ * PCI address, netdev, MAC, VLAN and driver without scanning sysfs or calling
+ * `ip link`. This header is self-contained and may be installed for consumers.
+ *
+ * Consistency is provided by a sequence lock: viod makes `seq` odd before it
+ * modifies the table and even again once the update is complete. Readers copy
+ * what they need and retry if `seq` was odd or changed while they were reading,
+ * up to INVENTORY_READ_RETRIES times: a viod that dies inside a write section
+ * leaves `seq` odd until it is restarted.
+ */
+#ifndef VIOD_INVENTORY_H
+#define VIOD_INVENTORY_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define INVENTORY_PATH "/run/viod/inventory"
+#define INVENTORY_MAGIC 0x56494f44u  /* "VIOD" */
+#define INVENTORY_VERSION 2
+#define INVENTORY_MAX_ENTRIES 1024
+#define INVENTORY_READ_RETRIES 4096 /* Lookups give up after this many busy reads */
+
+/* Lifecycle state of a published VF */
+typedef enum {
+    INVENTORY_STATE_UNUSED = 0,     /**< Slot is free */
+    INVENTORY_STATE_CONFIGURED,     /**< VF was created and fully configured */
+    INVENTORY_STATE_FAILED          /**< VF exists but at least one step failed */
+} inventory_state_t;
+
+/* One published Virtual Function */
+typedef struct {
+    int32_t vf_id;                  /**< VF index on its PF */
+    int32_t ifindex;                /**< VF netdev ifindex, 0 if none in host */
+    int32_t vlan;                   /**< VLAN ID, 0 if untagged */
+    uint32_t state;                 /**< inventory_state_t */
+    int32_t numa_node;              /**< NUMA node of the VF, -1 if not reported */
+    int32_t iommu_group;            /**< IOMMU group of the VF, -1 if none */
+    char pf_pci_addr[32];           /**< PF PCI address (full format) */
+    char vf_pci_addr[32];           /**< VF PCI address (full format) */
+    char driver[64];                /**< Driver currently bound to the VF */
+    char mac[18];                   /**< Applied MAC (network devices only) */
+    char reserved[6];
+} inventory_entry_t;
+
+/* Memory-mapped inventory file */
+typedef struct {
+    uint32_t magic;                 /**< INVENTORY_MAGIC once initialized */
+    uint32_t version;               /**< INVENTORY_VERSION */
+    uint32_t seq;                   /**< Sequence lock, odd while writing */
+    uint32_t count;                 /**< Number of valid entries */
+    uint64_t generation;            /**< Incremented on every committed update */
+    inventory_entry_t entries[INVENTORY_MAX_ENTRIES];
+} inventory_t;
+
+/**
+ * Find a VF by PF PCI address and VF index in a mapped inventory
+ * Copies the matching entry to *out. Makes no syscalls; spins at most
+ * INVENTORY_READ_RETRIES times while viod is writing.
+ * Returns 1 if found, 0 if not found, -1 if the mapping is not a valid inventory
+ * or stayed busy (callers may try again later)
+ */
+static inline int inventory_lookup_vf(const inventory_t *inv, const char *pf_pci_addr,
+                                      int vf_id, inventory_entry_t *out) {
+    if (__atomic_load_n(&inv->magic, __ATOMIC_ACQUIRE) != INVENTORY_MAGIC ||
+        inv->version != INVENTORY_VERSION) {
+        return -1;
+    }
+
+    for (int attempt = 0; attempt < INVENTORY_READ_RETRIES; attempt++) {
+        uint32_t seq = __atomic_load_n(&inv->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue; /* Writer active */
+
+        int found = 0;
+        uint32_t count = inv->count;
+        if (count > INVENTORY_MAX_ENTRIES) count = INVENTORY_MAX_ENTRIES;
+
+        for (uint32_t i = 0; i < count; i++) {
+            const inventory_entry_t *e = &inv->entries[i];
+            if (e->vf_id == vf_id &&
+                strncmp(e->pf_pci_addr, pf_pci_addr, sizeof(e->pf_pci_addr)) == 0) {
+                memcpy(out, e, sizeof(*out));
+                found = 1;
+                break;
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&inv->seq, __ATOMIC_RELAXED) == seq) {
+            return found;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Find a VF by its applied MAC address in a mapped inventory
+ * Comparison is case-insensitive on hex digits. Same semantics as inventory_lookup_vf().
+ */
+static inline int inventory_lookup_mac(const inventory_t *inv, const char *mac,
+                                       inventory_entry_t *out) {
+    if (__atomic_load_n(&inv->magic, __ATOMIC_ACQUIRE) != INVENTORY_MAGIC ||
+        inv->version != INVENTORY_VERSION) {
+        return -1;
+    }
+
+    for (int attempt = 0; attempt < INVENTORY_READ_RETRIES; attempt++) {
+        uint32_t seq = __atomic_load_n(&inv->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue; /* Writer active */
+
+        int found = 0;
+        uint32_t count = inv->count;
+        if (count > INVENTORY_MAX_ENTRIES) count = INVENTORY_MAX_ENTRIES;
+
+        for (uint32_t i = 0; i < count && !found; i++) {
+            const inventory_entry_t *e = &inv->entries[i];
+            int match = 1;
+            for (size_t j = 0; j < sizeof(e->mac); j++) {
+                char a = e->mac[j], b = mac[j];
+                if (a >= 'A' && a <= 'F') a += 'a' - 'A';
+                if (b >= 'A' && b <= 'F') b += 'a' - 'A';
+                if (a != b) { match = 0; break; }
+                if (a == '\0') break;
+            }
+            if (match && e->mac[0] != '\0') {
+                memcpy(out, e, sizeof(*out));
+                found = 1;
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&inv->seq, __ATOMIC_RELAXED) == seq) {
+            return found;
+        }
+    }
+    return -1;
+}
+
+#endif // VIOD_INVENTORY_H
@@ -7,19 +7,36 @@
 #include "viod.h"
 #include <stdarg.h>
 
+static int syslog_enabled = 0;
+
+/**
+ * Select the log destination
+ * With syslog, stderr is only used when it is a terminal; without it (early
+ * boot, where there may be no syslog socket yet), everything goes to stderr.
+ */
+void log_init(int use_syslog) {
+    syslog_enabled = use_syslog;
+    if (use_syslog) {
+        openlog("viod", LOG_PID | LOG_CONS, LOG_DAEMON);
+    }
+}
+
 /**
  * Log a message with the specified priority
  * Logs to syslog and optionally to stderr if running interactively
  */
 void log_message(int priority, const char *format, ...) {
-    va_list args;
+    va_list args, stderr_args;
     va_start(args, format);
+    va_copy(stderr_args, args);
     
     /* Log to syslog (for daemon mode) */
-    vsyslog(priority, format, args);
+    if (syslog_enabled) {
+        vsyslog(priority, format, args);
+    }
     
-    /* Also log to stderr for interactive mode */
-    if (isatty(STDERR_FILENO)) {
+    /* Also log to stderr for interactive and one-shot mode */
+    if (!syslog_enabled || isatty(STDERR_FILENO)) {
         const char *level_str;
         switch (priority) {
             case LOG_ERR:     level_str = "ERROR"; break;
@@ -29,10 +46,14 @@ void log_message(int priority, const char *format, ...) {
             default:          level_str = "UNKNOWN"; break;
         }
         
+        /* Keep lines from the main and reconcile threads whole */
+        flockfile(stderr);
         fprintf(stderr, "[%s] ", level_str);
-        vfprintf(stderr, format, args);
+        vfprintf(stderr, format, stderr_args);
         fprintf(stderr, "\n");
+        funlockfile(stderr);
     }
     
+    va_end(stderr_args);
     va_end(args);
 }
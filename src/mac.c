@@ -0,0 +1,286 @@
+/**
+ * viod - SR-IOV Virtual Function daemon
+ *
+ * MAC address index implementation
+ * Assigns every VF of every loaded network PF its MAC when configurations are
+ * loaded, using an open-addressing hash table keyed by the 48-bit address:
+ *   - configured MACs are indexed first; a configuration reusing a MAC that
+ *     an earlier one (in load order) already claimed is rejected
+ *   - generated MACs that hit an indexed address are rehashed with an
+ *     attempt counter until they are unique, so the result only depends on
+ *     the set of loaded configurations
+ * The site-wide salt and prefix from SITE_CONFIG_PATH keep generated MACs of
+ * different hosts apart.
+ */
+#include "viod.h"
+
+#define MAC_SLOT_USED (1ULL << 63)  /* Set in the key of every occupied slot */
+#define MAC_MULTICAST (1ULL << 40)  /* I/G bit of the first octet */
+#define MAC_MAX_ATTEMPTS 64         /* Rehashes before giving up on a VF */
+
+/* One indexed MAC */
+typedef struct {
+    uint64_t key;                   /**< MAC | MAC_SLOT_USED, 0 if the slot is empty */
+    int config;                     /**< Owning config index, -1 once it is rejected */
+    int vf;                         /**< Owning VF index */
+} mac_slot_t;
+
+typedef struct {
+    mac_slot_t *slots;
+    size_t mask;                    /**< Slot count - 1 (a power of two) */
+} mac_index_t;
+
+/**
+ * Generate a stable, deterministic MAC address for a VF
+ * Uses SHA256 hash of PCI address, VF ID, and salt to ensure:
+ * - Consistent MAC across reboots
+ * - Unique MACs per PF/VF combination
+ * - Locally administered format (02:xx:xx:xx:xx:xx) to avoid conflicts
+ * The site salt and a non-zero attempt are appended to the hashed input, and a
+ * site prefix replaces the leading 02; without them the MAC is unchanged.
+ */
+void generate_stable_mac(const char *pf_pci_addr, int vf_id, const site_config_t *site,
+                         int attempt, char *mac_addr) {
+    static const unsigned char default_prefix[] = { 0x02 };
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    unsigned char octets[6];
+    char input[512];
+    const unsigned char *prefix = default_prefix;
+    int prefix_len = sizeof(default_prefix);
+
+    /* Create deterministic input string: PCI address + VF ID + "viod" */
+    int len = snprintf(input, sizeof(input), "%s-%d-viod", pf_pci_addr, vf_id);
+    if (site && site->mac_salt[0]) {
+        len += snprintf(input + len, sizeof(input) - len, "-%s", site->mac_salt);
+    }
+    if (attempt > 0) {
+        snprintf(input + len, sizeof(input) - len, "-%d", attempt);
+    }
+
+    sha256(input, strlen(input), hash);
+
+    if (site && site->mac_prefix_len > 0) {
+        prefix = site->mac_prefix;
+        prefix_len = site->mac_prefix_len;
+    }
+    memcpy(octets, prefix, prefix_len);
+    memcpy(octets + prefix_len, hash, sizeof(octets) - prefix_len);
+
+    snprintf(mac_addr, 18, "%02x:%02x:%02x:%02x:%02x:%02x",
+             octets[0], octets[1], octets[2], octets[3], octets[4], octets[5]);
+}
+
+/**
+ * Parse a colon-separated MAC address into a 48-bit key
+ * Returns 0 on success, -1 if the address is malformed
+ */
+static int mac_to_key(const char *mac, uint64_t *key) {
+    unsigned int octets[6];
+    int end = 0;
+
+    if (sscanf(mac, "%2x:%2x:%2x:%2x:%2x:%2x%n", &octets[0], &octets[1], &octets[2],
+               &octets[3], &octets[4], &octets[5], &end) != 6 || end != 17 || mac[end] != '\0') {
+        return -1;
+    }
+
+    *key = 0;
+    for (int i = 0; i < 6; i++) {
+        *key = *key << 8 | octets[i];
+    }
+    return 0;
+}
+
+static mac_slot_t *index_probe(const mac_index_t *index, uint64_t key) {
+    /* Fibonacci hashing spreads the sequential low octets of vendor MACs */
+    size_t i = (size_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) & index->mask;
+
+    for (;; i = (i + 1) & index->mask) {
+        mac_slot_t *slot = &index->slots[i];
+        if (slot->key == 0 || (slot->key == (key | MAC_SLOT_USED) && slot->config >= 0)) {
+            return slot;
+        }
+    }
+}
+
+/**
+ * Find the live owner of a MAC
+ * Returns the slot, or NULL if no accepted VF uses the address
+ */
+static mac_slot_t *index_lookup(const mac_index_t *index, uint64_t key) {
+    mac_slot_t *slot = index_probe(index, key);
+    return slot->key ? slot : NULL;
+}
+
+static void index_insert(mac_index_t *index, uint64_t key, int config, int vf) {
+    mac_slot_t *slot = index_probe(index, key);
+    slot->key = key | MAC_SLOT_USED;
+    slot->config = config;
+    slot->vf = vf;
+}
+
+/**
+ * Drop the MACs of a rejected configuration
+ * Slots stay occupied so probe chains through them remain intact.
+ */
+static void index_reject(mac_index_t *index, int config) {
+    for (size_t i = 0; i <= index->mask; i++) {
+        if (index->slots[i].key && index->slots[i].config == config) {
+            index->slots[i].config = -1;
+        }
+    }
+}
+
+/**
+ * Index the configured MACs of one PF
+ * Returns 0 on success, -1 if the configuration must be rejected
+ */
+static int index_static_macs(mac_index_t *index, const config_list_t *configs, int c) {
+    const pf_config_t *config = &configs->configs[c];
+
+    for (int i = 0; i < config->num_vfs && i < MAX_VFS; i++) {
+        const vf_config_t *vf = &config->vfs[i];
+        uint64_t key;
+
+        if (vf->mac[0] == '\0') continue;
+
+        if (mac_to_key(vf->mac, &key) != 0) {
+            log_message(LOG_ERR, "PF %s: invalid MAC %s for VF %d in %s",
+                       config->name, vf->mac, i, config->config_file);
+            return -1;
+        }
+        if (key & MAC_MULTICAST) {
+            log_message(LOG_ERR, "PF %s: MAC %s for VF %d in %s is a multicast address",
+                       config->name, vf->mac, i, config->config_file);
+            return -1;
+        }
+
+        mac_slot_t *owner = index_lookup(index, key);
+        if (owner) {
+            const pf_config_t *other = &configs->configs[owner->config];
+            log_message(LOG_ERR, "PF %s: MAC %s for VF %d in %s is already used by VF %d of %s (%s)",
+                       config->name, vf->mac, i, config->config_file,
+                       owner->vf, other->name, other->config_file);
+            return -1;
+        }
+        index_insert(index, key, c, i);
+    }
+    return 0;
+}
+
+/**
+ * Generate and index the MACs of the VFs of one PF that have none configured
+ * Returns 0 on success, -1 if a VF found no free MAC
+ */
+static int index_generated_macs(mac_index_t *index, config_list_t *configs, int c,
+                                const site_config_t *site) {
+    pf_config_t *config = &configs->configs[c];
+
+    for (int i = 0; i < config->num_vfs && i < MAX_VFS; i++) {
+        vf_config_t *vf = &config->vfs[i];
+        char mac[18];
+        uint64_t key = 0;
+        mac_slot_t *owner = NULL;
+        int attempt;
+
+        if (vf->mac[0] != '\0') continue;
+
+        for (attempt = 0; attempt < MAC_MAX_ATTEMPTS; attempt++) {
+            generate_stable_mac(config->name, i, site, attempt, mac);
+            mac_to_key(mac, &key);
+            owner = index_lookup(index, key);
+            if (!owner) break;
+
+            log_message(LOG_WARNING, "PF %s: generated MAC %s for VF %d collides with VF %d of %s, rehashing",
+                       config->name, mac, i, owner->vf, configs->configs[owner->config].name);
+        }
+        if (owner) {
+            log_message(LOG_ERR, "PF %s: no free MAC for VF %d after %d attempts",
+                       config->name, i, MAC_MAX_ATTEMPTS);
+            return -1;
+        }
+
+        index_insert(index, key, c, i);
+        memcpy(vf->mac, mac, sizeof(vf->mac));
+        vf->mac_generated = 1;
+    }
+    return 0;
+}
+
+/**
+ * Assign and cross-check the MACs of all VFs of all network PFs
+ * Fills in generated MACs and removes configurations whose MACs conflict
+ * with an earlier one, so reconciling a generation never applies a MAC twice.
+ * Returns 0 on success, -1 on allocation failure
+ */
+int mac_index_build(config_list_t *configs, const site_config_t *site) {
+    mac_index_t index;
+    size_t vfs = 0;
+    size_t size = 16;
+
+    /* Sized with the same clamp as the loops below; num_vfs is checked by
+     * the parser, but this must not trust it */
+    for (size_t c = 0; c < configs->count; c++) {
+        int num_vfs = configs->configs[c].num_vfs;
+        if (configs->configs[c].kind == DEVICE_KIND_NET && num_vfs > 0) {
+            vfs += num_vfs < MAX_VFS ? num_vfs : MAX_VFS;
+        }
+    }
+    if (vfs == 0) {
+        return 0;
+    }
+
+    /* Keep the load factor at or below one half */
+    while (size < vfs * 2) {
+        size *= 2;
+    }
+    index.slots = calloc(size, sizeof(mac_slot_t));
+    unsigned char *rejected = calloc(configs->count, 1);
+    if (!index.slots || !rejected) {
+        log_message(LOG_ERR, "Failed to allocate memory for MAC index");
+        free(index.slots);
+        free(rejected);
+        return -1;
+    }
+    index.mask = size - 1;
+
+    /* Configured MACs first: they cannot move, generated ones can */
+    for (size_t c = 0; c < configs->count; c++) {
+        if (configs->configs[c].kind != DEVICE_KIND_NET) continue;
+        if (index_static_macs(&index, configs, (int)c) != 0) {
+            index_reject(&index, (int)c);
+            rejected[c] = 1;
+        }
+    }
+    for (size_t c = 0; c < configs->count; c++) {
+        if (configs->configs[c].kind != DEVICE_KIND_NET || rejected[c]) continue;
+        if (index_generated_macs(&index, configs, (int)c, site) != 0) {
+            index_reject(&index, (int)c);
+            rejected[c] = 1;
+        }
+    }
+
+    /* Drop rejected configurations; their VFs are left as they are */
+    size_t kept = 0;
+    vfs = 0;
+    for (size_t c = 0; c < configs->count; c++) {
+        if (rejected[c]) {
+            log_message(LOG_ERR, "Ignoring %s for PF %s because of MAC errors",
+                       configs->configs[c].config_file, configs->configs[c].name);
+            continue;
+        }
+        if (kept != c) {
+            configs->configs[kept] = configs->configs[c];
+        }
+        int num_vfs = configs->configs[kept].num_vfs;
+        if (configs->configs[kept].kind == DEVICE_KIND_NET && num_vfs > 0) {
+            vfs += num_vfs < MAX_VFS ? num_vfs : MAX_VFS;
+        }
+        kept++;
+    }
+    log_message(LOG_DEBUG, "Indexed %zu VF MAC(s) of %zu PF(s)", vfs, kept);
+    configs->count = kept;
+
+    free(index.slots);
+    free(rejected);
+    return 0;
+}
@@ -6,20 +6,72 @@
  */
 #include "viod.h"
 
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
 /* Global daemon state */
-static volatile int running = 1;
+static int running = 1;
+static int stats_timer_fd = -1;
 
 /**
- * Signal handler for daemon control
- * Handles SIGTERM/SIGINT for graceful shutdown and SIGHUP for reload
+ * Block daemon signals and receive them through a signalfd instead
+ * Signals are blocked before any thread starts, so all threads inherit the mask.
+ * Returns file descriptor on success, -1 on failure
  */
-static void signal_handler(int sig) {
-    if (sig == SIGTERM || sig == SIGINT) {
-        log_message(LOG_INFO, "Received signal %d, shutting down", sig);
-        running = 0;
-    } else if (sig == SIGHUP) {
-        log_message(LOG_INFO, "Received SIGHUP, reloading configurations");
-        /* Signal will be handled in main loop */
+static int open_signalfd(void) {
+    sigset_t mask;
+    
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGHUP);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0) {
+        log_message(LOG_ERR, "Failed to block signals: %s", strerror(errno));
+        return -1;
+    }
+    
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0) {
+        log_message(LOG_ERR, "Failed to create signalfd: %s", strerror(errno));
+    }
+    return fd;
+}
+
+/**
+ * Arm a timerfd to fire once after ms, then every interval_ms (0 for one-shot)
+ * ms = 0 disarms the timer.
+ */
+static void arm_timer(int fd, long ms, long interval_ms) {
+    struct itimerspec spec = {
+        .it_value = { ms / 1000, (ms % 1000) * 1000000 },
+        .it_interval = { interval_ms / 1000, (interval_ms % 1000) * 1000000 },
+    };
+    
+    if (fd >= 0 && timerfd_settime(fd, 0, &spec, NULL) != 0) {
+        log_message(LOG_ERR, "Failed to arm timer: %s", strerror(errno));
+    }
+}
+
+/**
+ * Consume a timerfd expiration
+ */
+static void drain_timer(int fd) {
+    uint64_t expirations;
+    
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        log_message(LOG_ERR, "Failed to read timer: %s", strerror(errno));
+    }
+}
+
+/**
+ * Add a file descriptor to the epoll set (ignored if fd is -1)
+ */
+static void epoll_watch(int epoll_fd, int fd) {
+    struct epoll_event event = { .events = EPOLLIN, .data.fd = fd };
+    
+    if (fd >= 0 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        log_message(LOG_ERR, "Failed to watch fd %d: %s", fd, strerror(errno));
     }
 }
 
@@ -28,7 +80,7 @@ static void signal_handler(int sig) {
  * Returns file descriptor on success, -1 on failure
  */
 static int watch_config_directory(void) {
-    int inotify_fd = inotify_init();
+    int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
     if (inotify_fd < 0) {
         log_message(LOG_ERR, "Failed to initialize inotify: %s", strerror(errno));
         return -1;
@@ -47,47 +99,105 @@ static int watch_config_directory(void) {
 }
 
 /**
- * Reload all configurations from disk and apply them
+ * Reload all configurations from disk and hand them to the reconcile worker
+ * Parsing is cheap and done inline; applying happens on the worker thread.
  * Returns 0 on success, -1 on failure
  */
-static int reload_configurations(config_list_t *configs) {
-    log_message(LOG_INFO, "Reloading configurations");
+static int reload_configurations(void) {
+    config_list_t configs = {0};
     
-    /* Clean up old configs */
-    cleanup_configs(configs);
+    log_message(LOG_INFO, "Reloading configurations");
     
     /* Load new configs */
-    if (load_all_configs(configs) != 0) {
+    if (load_all_configs(&configs) != 0) {
         log_message(LOG_ERR, "Failed to load configurations");
+        cleanup_configs(&configs);
         return -1;
     }
     
-    /* Apply all configurations */
-    if (apply_all_configs(configs) != 0) {
-        log_message(LOG_ERR, "Failed to apply configurations");
-        return -1;
+    log_message(LOG_INFO, "Loaded %zu configuration(s)", configs.count);
+    
+    /* Export VF counters for the PFs in this generation; no timer without any */
+    if (stats_set_targets(&configs) > 0) {
+        arm_timer(stats_timer_fd, STATS_INTERVAL * 1000, STATS_INTERVAL * 1000);
+    } else {
+        arm_timer(stats_timer_fd, 0, 0);
     }
     
-    log_message(LOG_INFO, "Successfully reloaded %zu configuration(s)", configs->count);
+    /* Queue for reconcile; supersedes any generation not yet started */
+    reconcile_submit(&configs);
     return 0;
 }
 
-int main(int argc, char *argv[]) {
-    (void)argc; (void)argv; // Suppress unused parameter warnings
-    
+/**
+ * Apply all configurations once and exit (early boot / initramfs)
+ * No syslog, inotify, uevents or statistics; the state left in RUNTIME_DIR
+ * lets the daemon adopt what was applied here.
+ * Returns the process exit status: 0 if every PF was applied, 1 otherwise
+ */
+static int run_oneshot(void) {
     config_list_t configs = {0};
+    
+    log_message(LOG_INFO, "viod applying configurations once");
+    
+    if (access(CONFIG_DIR, F_OK) != 0) {
+        log_message(LOG_INFO, "No %s, nothing to apply", CONFIG_DIR);
+        return 0;
+    }
+    
+    if (inventory_open() != 0) {
+        log_message(LOG_WARNING, "VF inventory disabled");
+    }
+    if (trace_init() != 0) {
+        log_message(LOG_WARNING, "Reconcile tracing disabled");
+    }
+    
+    int failed = 1;
+    if (load_all_configs(&configs) == 0) {
+        failed = reconcile_oneshot(&configs);
+        trace_flush(0);
+    } else {
+        log_message(LOG_ERR, "Failed to load configurations");
+    }
+    
+    cleanup_configs(&configs);
+    probe_cleanup();
+    trace_cleanup();
+    inventory_close();
+    
+    return failed ? 1 : 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--oneshot]\n"
+            "  --oneshot  apply all configurations once and exit\n", prog);
+}
+
+int main(int argc, char *argv[]) {
     int inotify_fd = -1;
+    int uevent_fd = -1;
+    int exit_code = 0;
     
-    // Setup signal handlers
-    signal(SIGTERM, signal_handler);
-    signal(SIGINT, signal_handler);
-    signal(SIGHUP, signal_handler);
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "--oneshot") != 0)) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (argc == 2) {
+        log_init(0);
+        return run_oneshot();
+    }
     
     // Open syslog
-    openlog("viod", LOG_PID | LOG_CONS, LOG_DAEMON);
+    log_init(1);
     
     log_message(LOG_INFO, "viod starting - SR-IOV VF daemon");
     
+    // Receive signals in the main loop rather than in a handler
+    int signal_fd = open_signalfd();
+    if (signal_fd < 0) {
+        return 1;
+    }
+    
     // Create config directory if it doesn't exist
     if (mkdir(CONFIG_DIR, 0755) != 0 && errno != EEXIST) {
         log_message(LOG_ERR, "Failed to create config directory %s: %s", 
@@ -95,49 +205,108 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int reload_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    stats_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epoll_fd < 0 || reload_timer_fd < 0 || stats_timer_fd < 0) {
+        log_message(LOG_ERR, "Failed to set up event loop: %s", strerror(errno));
+        return 1;
+    }
+    
+    // Publish applied VFs for local consumers
+    if (inventory_open() != 0) {
+        log_message(LOG_WARNING, "VF inventory disabled");
+    }
+    
+    // Optional reconcile timeline tracing (VIOD_TRACE_DIR)
+    if (trace_init() != 0) {
+        log_message(LOG_WARNING, "Reconcile tracing disabled");
+    }
+    
+    // Export VF traffic statistics
+    if (stats_open() != 0) {
+        log_message(LOG_WARNING, "VF statistics export disabled");
+    }
+    
+    // Refresh cached PF capabilities when devices change
+    uevent_fd = uevent_open();
+    if (uevent_fd < 0) {
+        log_message(LOG_WARNING, "PF capability cache will not be refreshed on uevents");
+    }
+    
+    // Start applying configurations in the background
+    if (reconcile_start() != 0) {
+        return 1;
+    }
+    
     // Load initial configurations
-    if (reload_configurations(&configs) != 0) {
+    if (reload_configurations() != 0) {
         log_message(LOG_ERR, "Failed to load initial configurations");
+        reconcile_stop();
         return 1;
     }
     
     // Setup file system monitoring
     inotify_fd = watch_config_directory();
     if (inotify_fd < 0) {
-        log_message(LOG_WARNING, "File system monitoring disabled");
+        log_message(LOG_WARNING, "File system monitoring disabled, reload with SIGHUP");
     } else {
         log_message(LOG_INFO, "Monitoring %s for configuration changes", CONFIG_DIR);
     }
     
-    // Main daemon loop
+    epoll_watch(epoll_fd, signal_fd);
+    epoll_watch(epoll_fd, inotify_fd);
+    epoll_watch(epoll_fd, uevent_fd);
+    epoll_watch(epoll_fd, reload_timer_fd);
+    epoll_watch(epoll_fd, stats_timer_fd);
+    
+    // Main daemon loop: sleeps until an event arrives, no periodic wakeups
     while (running) {
-        if (inotify_fd >= 0) {
-            fd_set readfds;
-            struct timeval timeout;
-            
-            FD_ZERO(&readfds);
-            FD_SET(inotify_fd, &readfds);
-            
-            timeout.tv_sec = 5;  // 5 second timeout
-            timeout.tv_usec = 0;
-            
-            int ret = select(inotify_fd + 1, &readfds, NULL, NULL, &timeout);
+        struct epoll_event events[8];
+        
+        int count = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(events[0]), -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            log_message(LOG_ERR, "epoll_wait failed: %s", strerror(errno));
+            exit_code = 1;
+            break;
+        }
+        
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
             
-            if (ret > 0 && FD_ISSET(inotify_fd, &readfds)) {
-                // Configuration file changed
+            if (fd == signal_fd) {
+                struct signalfd_siginfo info;
+                while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                    if (info.ssi_signo == SIGHUP) {
+                        log_message(LOG_INFO, "Received SIGHUP, reloading configurations");
+                        arm_timer(reload_timer_fd, 0, 0);
+                        reload_configurations();
+                    } else {
+                        log_message(LOG_INFO, "Received signal %u, shutting down", info.ssi_signo);
+                        running = 0;
+                    }
+                }
+            } else if (fd == inotify_fd) {
+                // Configuration file changed; wait for writes to settle before reloading
                 char buffer[4096];
-                ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
-                
-                if (length > 0) {
-                    log_message(LOG_INFO, "Configuration directory changed, reloading");
-                    // Small delay to ensure file operations are complete
-                    sleep(1);
-                    reload_configurations(&configs);
+                int changed = 0;
+                while (read(inotify_fd, buffer, sizeof(buffer)) > 0) {
+                    changed = 1;
                 }
+                if (changed) {
+                    arm_timer(reload_timer_fd, RELOAD_DEBOUNCE_MS, 0);
+                }
+            } else if (fd == reload_timer_fd) {
+                drain_timer(reload_timer_fd);
+                log_message(LOG_INFO, "Configuration directory changed, reloading");
+                reload_configurations();
+            } else if (fd == stats_timer_fd) {
+                drain_timer(stats_timer_fd);
+                stats_collect();
+            } else if (fd == uevent_fd) {
+                uevent_handle(uevent_fd);
             }
-        } else {
-            // No file monitoring, just sleep
-            sleep(5);
         }
     }
     
@@ -147,9 +316,21 @@ int main(int argc, char *argv[]) {
     if (inotify_fd >= 0) {
         close(inotify_fd);
     }
+    if (uevent_fd >= 0) {
+        close(uevent_fd);
+    }
     
-    cleanup_configs(&configs);
+    reconcile_stop();
+    probe_cleanup();
+    stats_close();
+    trace_cleanup();
+    inventory_close();
+    
+    close(stats_timer_fd);
+    close(reload_timer_fd);
+    close(signal_fd);
+    close(epoll_fd);
     closelog();
     
-    return 0;
+    return exit_code;
 }
@@ -0,0 +1,576 @@
+/**
+ * viod - SR-IOV Virtual Function daemon
+ *
+ * rtnetlink implementation
+ * Minimal netlink message building, request/ACK and dump helpers used to
+ * configure VFs and read VF statistics without spawning `ip`.
+ */
+#include "viod.h"
+#include <sys/socket.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+
+#define NL_RECV_BUFSIZE 65536
+
+static unsigned int nl_seq = 0;
+
+/**
+ * Open and bind a netlink socket (NETLINK_ROUTE, NETLINK_GENERIC, ...)
+ * Returns file descriptor on success, -1 on failure
+ */
+int nl_open(int protocol) {
+    struct sockaddr_nl addr;
+
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
+    if (fd < 0) {
+        log_message(LOG_ERR, "Cannot open netlink socket: %s", strerror(errno));
+        return -1;
+    }
+
+    /* Ask for extended ACKs so kernel error messages can be logged */
+    int one = 1;
+    setsockopt(fd, SOL_NETLINK, NETLINK_EXT_ACK, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        log_message(LOG_ERR, "Cannot bind netlink socket: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Start a netlink message in buf
+ * Returns the message header; payload of hdr_len bytes is zeroed
+ */
+struct nlmsghdr *nl_msg_init(void *buf, size_t size, int type, int flags, size_t hdr_len) {
+    struct nlmsghdr *nlh = buf;
+
+    memset(buf, 0, size < NLMSG_SPACE(hdr_len) ? size : NLMSG_SPACE(hdr_len));
+    nlh->nlmsg_len = NLMSG_LENGTH(hdr_len);
+    nlh->nlmsg_type = type;
+    nlh->nlmsg_flags = flags;
+    nlh->nlmsg_seq = __atomic_add_fetch(&nl_seq, 1, __ATOMIC_RELAXED);
+    return nlh;
+}
+
+/**
+ * Append an attribute to a netlink message
+ * Returns 0 on success, -1 if the buffer is too small
+ */
+int nl_attr_put(struct nlmsghdr *nlh, size_t size, int type, const void *data, size_t len) {
+    size_t attr_len = RTA_LENGTH(len);
+
+    if (NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(attr_len) > size) {
+        log_message(LOG_ERR, "Netlink message too large for attribute %d", type);
+        return -1;
+    }
+
+    struct rtattr *rta = (struct rtattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+    rta->rta_type = type;
+    rta->rta_len = attr_len;
+    if (len) {
+        memcpy(RTA_DATA(rta), data, len);
+    }
+    nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_ALIGN(attr_len);
+    return 0;
+}
+
+int nl_attr_put_u32(struct nlmsghdr *nlh, size_t size, int type, uint32_t value) {
+    return nl_attr_put(nlh, size, type, &value, sizeof(value));
+}
+
+int nl_attr_put_str(struct nlmsghdr *nlh, size_t size, int type, const char *value) {
+    return nl_attr_put(nlh, size, type, value, strlen(value) + 1);
+}
+
+/**
+ * Open a nested attribute; close it with nl_nest_end()
+ * Returns the nest start, or NULL if the buffer is too small
+ */
+struct rtattr *nl_nest_begin(struct nlmsghdr *nlh, size_t size, int type) {
+    struct rtattr *nest = (struct rtattr *)((char *)nlh + NLMSG_ALIGN(nlh->nlmsg_len));
+
+    if (nl_attr_put(nlh, size, type, NULL, 0) != 0) {
+        return NULL;
+    }
+    return nest;
+}
+
+void nl_nest_end(struct nlmsghdr *nlh, struct rtattr *nest) {
+    nest->rta_len = (char *)nlh + nlh->nlmsg_len - (char *)nest;
+}
+
+/**
+ * Receive one datagram, growing the buffer if the kernel has more to give
+ * Returns received length, or -1 on failure
+ */
+static ssize_t nl_recv(int fd, char **buf, size_t *size) {
+    for (;;) {
+        ssize_t len = recv(fd, *buf, *size, MSG_PEEK | MSG_TRUNC);
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if ((size_t)len > *size) {
+            char *grown = realloc(*buf, len);
+            if (!grown) {
+                errno = ENOMEM;
+                return -1;
+            }
+            *buf = grown;
+            *size = len;
+        }
+        return recv(fd, *buf, *size, 0);
+    }
+}
+
+/**
+ * Send a request with NLM_F_ACK and wait for the kernel's verdict
+ * Replies other than the ACK are passed to callback (which may be NULL).
+ * Returns 0 on success, negative errno on failure
+ */
+int nl_request(int fd, struct nlmsghdr *nlh, nl_dump_cb_t callback, void *ctx) {
+    size_t size = NL_RECV_BUFSIZE;
+    char *buf = malloc(size);
+    int result = -EIO;
+
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    nlh->nlmsg_flags |= NLM_F_ACK;
+    if (send(fd, nlh, nlh->nlmsg_len, 0) < 0) {
+        result = -errno;
+        free(buf);
+        return result;
+    }
+
+    for (;;) {
+        ssize_t len = nl_recv(fd, &buf, &size);
+        if (len < 0) {
+            result = -errno;
+            break;
+        }
+
+        struct nlmsghdr *msg;
+        for (msg = (struct nlmsghdr *)buf; NLMSG_OK(msg, (size_t)len); msg = NLMSG_NEXT(msg, len)) {
+            if (msg->nlmsg_seq != nlh->nlmsg_seq) {
+                continue;
+            }
+            if (msg->nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr *err = NLMSG_DATA(msg);
+                result = err->error;
+                goto out;
+            }
+            if (callback) {
+                callback(msg, ctx);
+            }
+        }
+    }
+
+out:
+    free(buf);
+    return result;
+}
+
+int nl_transact(int fd, struct nlmsghdr *nlh) {
+    return nl_request(fd, nlh, NULL, NULL);
+}
+
+/**
+ * Send a dump request and invoke callback for every reply message
+ * Returns 0 on success, negative errno on failure
+ */
+int nl_dump(int fd, struct nlmsghdr *nlh, nl_dump_cb_t callback, void *ctx) {
+    size_t size = NL_RECV_BUFSIZE;
+    char *buf = malloc(size);
+    int result = 0;
+
+    if (!buf) {
+        return -ENOMEM;
+    }
+
+    nlh->nlmsg_flags |= NLM_F_REQUEST | NLM_F_DUMP;
+    if (send(fd, nlh, nlh->nlmsg_len, 0) < 0) {
+        result = -errno;
+        free(buf);
+        return result;
+    }
+
+    for (;;) {
+        ssize_t len = nl_recv(fd, &buf, &size);
+        if (len < 0) {
+            result = -errno;
+            break;
+        }
+
+        struct nlmsghdr *msg;
+        for (msg = (struct nlmsghdr *)buf; NLMSG_OK(msg, (size_t)len); msg = NLMSG_NEXT(msg, len)) {
+            if (msg->nlmsg_seq != nlh->nlmsg_seq) {
+                continue;
+            }
+            if (msg->nlmsg_type == NLMSG_DONE) {
+                goto out;
+            }
+            if (msg->nlmsg_type == NLMSG_ERROR) {
+                result = ((struct nlmsgerr *)NLMSG_DATA(msg))->error;
+                goto out;
+            }
+            callback(msg, ctx);
+        }
+    }
+
+out:
+    free(buf);
+    return result;
+}
+
+/**
+ * Index nested attributes by type
+ * tb must have room for max + 1 entries; unknown types are ignored
+ */
+void nl_parse_attrs(struct rtattr *tb[], int max, struct rtattr *rta, int len) {
+    memset(tb, 0, sizeof(struct rtattr *) * (max + 1));
+    for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        int type = rta->rta_type & ~NLA_F_NESTED;
+        if (type <= max) {
+            tb[type] = rta;
+        }
+    }
+}
+
+/**
+ * Resolve the ifindex of a PCI device's netdev
+ * Returns ifindex on success, 0 if the device has no netdev
+ */
+int get_pci_ifindex(const char *pci_addr) {
+    char interface_name[IF_NAMESIZE];
+
+    if (get_pci_interface(pci_addr, interface_name, sizeof(interface_name)) != 0) {
+        return 0;
+    }
+    return if_nametoindex(interface_name);
+}
+
+/**
+ * Send one IFLA_VF_INFO attribute for a VF through its PF
+ * Returns 0 on success, negative errno on failure
+ */
+static int send_vf_attr(int ifindex, int attr, const void *data, size_t len) {
+    char buf[512];
+
+    struct nlmsghdr *nlh = nl_msg_init(buf, sizeof(buf), RTM_SETLINK, NLM_F_REQUEST,
+                                       sizeof(struct ifinfomsg));
+    struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_index = ifindex;
+
+    struct rtattr *vf_list = nl_nest_begin(nlh, sizeof(buf), IFLA_VFINFO_LIST);
+    struct rtattr *vf_info = nl_nest_begin(nlh, sizeof(buf), IFLA_VF_INFO);
+    nl_attr_put(nlh, sizeof(buf), attr, data, len);
+    nl_nest_end(nlh, vf_info);
+    nl_nest_end(nlh, vf_list);
+
+    int fd = nl_open(NETLINK_ROUTE);
+    if (fd < 0) {
+        return -EIO;
+    }
+    int result = nl_transact(fd, nlh);
+    close(fd);
+    return result;
+}
+
+int set_vf_link_state(const char *pf_pci_addr, int vf_id, vf_link_state_t state) {
+    static const uint32_t kernel_state[] = {
+        [VF_LINK_STATE_AUTO] = IFLA_VF_LINK_STATE_AUTO,
+        [VF_LINK_STATE_ENABLE] = IFLA_VF_LINK_STATE_ENABLE,
+        [VF_LINK_STATE_DISABLE] = IFLA_VF_LINK_STATE_DISABLE,
+    };
+
+    int ifindex = get_pci_ifindex(pf_pci_addr);
+    if (ifindex <= 0) {
+        log_message(LOG_ERR, "Cannot find network interface for PCI device %s", pf_pci_addr);
+        return -1;
+    }
+
+    struct ifla_vf_link_state link_state = {
+        .vf = vf_id,
+        .link_state = kernel_state[state],
+    };
+
+    int result = send_vf_attr(ifindex, IFLA_VF_LINK_STATE, &link_state, sizeof(link_state));
+    if (result != 0) {
+        log_message(LOG_ERR, "Failed to set link state for VF %d on %s: %s",
+                   vf_id, pf_pci_addr, strerror(-result));
+        return -1;
+    }
+
+    log_message(LOG_INFO, "Set link state %s for VF %d on %s",
+               vf_link_state_name(state), vf_id, pf_pci_addr);
+    return 0;
+}
+
+/**
+ * Set the MAC address of a VF
+ * Returns 0 on success, -1 on failure
+ */
+int set_vf_mac(const char *pf_pci_addr, int vf_id, const char *mac) {
+    struct ifla_vf_mac vf_mac = { .vf = vf_id };
+    int end = 0;
+
+    if (sscanf(mac, "%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx%n", &vf_mac.mac[0], &vf_mac.mac[1],
+               &vf_mac.mac[2], &vf_mac.mac[3], &vf_mac.mac[4], &vf_mac.mac[5], &end) != 6 ||
+        mac[end] != '\0') {
+        log_message(LOG_ERR, "Invalid MAC %s for VF %d on %s", mac, vf_id, pf_pci_addr);
+        return -1;
+    }
+
+    int ifindex = get_pci_ifindex(pf_pci_addr);
+    if (ifindex <= 0) {
+        log_message(LOG_ERR, "Cannot find network interface for PCI device %s", pf_pci_addr);
+        return -1;
+    }
+
+    int result = send_vf_attr(ifindex, IFLA_VF_MAC, &vf_mac, sizeof(vf_mac));
+    if (result != 0) {
+        log_message(LOG_ERR, "Failed to set MAC %s for VF %d on %s: %s",
+                   mac, vf_id, pf_pci_addr, strerror(-result));
+        return -1;
+    }
+
+    log_message(LOG_INFO, "Set MAC %s for VF %d on %s", mac, vf_id, pf_pci_addr);
+    return 0;
+}
+
+/**
+ * Set VLAN, priority and protocol (802.1Q or 802.1ad) for a VF
+ * proto 0 uses 802.1Q. Returns 0 on success, -1 on failure
+ */
+int set_vf_vlan(const char *pf_pci_addr, int vf_id, int vlan, int qos, int proto) {
+    int ifindex = get_pci_ifindex(pf_pci_addr);
+    if (ifindex <= 0) {
+        log_message(LOG_ERR, "Cannot find network interface for PCI device %s", pf_pci_addr);
+        return -1;
+    }
+
+    int result;
+    if (!proto || proto == ETH_P_8021Q) {
+        struct ifla_vf_vlan vf_vlan = {
+            .vf = vf_id,
+            .vlan = vlan,
+            .qos = qos,
+        };
+        result = send_vf_attr(ifindex, IFLA_VF_VLAN, &vf_vlan, sizeof(vf_vlan));
+    } else {
+        /* Only the VLAN list carries the protocol */
+        char list[64];
+        struct rtattr *info = (struct rtattr *)list;
+        struct ifla_vf_vlan_info vlan_info = {
+            .vf = vf_id,
+            .vlan = vlan,
+            .qos = qos,
+            .vlan_proto = htons(proto),
+        };
+        info->rta_type = IFLA_VF_VLAN_INFO;
+        info->rta_len = RTA_LENGTH(sizeof(vlan_info));
+        memcpy(RTA_DATA(info), &vlan_info, sizeof(vlan_info));
+        result = send_vf_attr(ifindex, IFLA_VF_VLAN_LIST, list, RTA_ALIGN(info->rta_len));
+    }
+
+    if (result != 0) {
+        log_message(LOG_ERR, "Failed to set VLAN %d qos %d for VF %d on %s: %s",
+                   vlan, qos, vf_id, pf_pci_addr, strerror(-result));
+        return -1;
+    }
+
+    log_message(LOG_INFO, "Set VLAN %d qos %d proto %s for VF %d on %s", vlan, qos,
+               proto == ETH_P_8021AD ? "802.1ad" : "802.1Q", vf_id, pf_pci_addr);
+    return 0;
+}
+
+/**
+ * Set an on/off VF setting: IFLA_VF_TRUST, IFLA_VF_SPOOFCHK or IFLA_VF_RSS_QUERY_EN
+ * All three share the { vf, setting } layout.
+ * Returns 0 on success, -1 on failure
+ */
+int set_vf_flag(const char *pf_pci_addr, int vf_id, int attr, vf_flag_t flag) {
+    const char *name = attr == IFLA_VF_TRUST ? "trust" :
+                       attr == IFLA_VF_SPOOFCHK ? "spoofchk" : "query_rss";
+
+    int ifindex = get_pci_ifindex(pf_pci_addr);
+    if (ifindex <= 0) {
+        log_message(LOG_ERR, "Cannot find network interface for PCI device %s", pf_pci_addr);
+        return -1;
+    }
+
+    struct ifla_vf_trust setting = {
+        .vf = vf_id,
+        .setting = flag == VF_FLAG_ON,
+    };
+
+    int result = send_vf_attr(ifindex, attr, &setting, sizeof(setting));
+    if (result != 0) {
+        log_message(LOG_ERR, "Failed to set %s for VF %d on %s: %s",
+                   name, vf_id, pf_pci_addr, strerror(-result));
+        return -1;
+    }
+
+    log_message(LOG_INFO, "Set %s %s for VF %d on %s", name, vf_flag_name(flag), vf_id, pf_pci_addr);
+    return 0;
+}
+
+/**
+ * Open a network namespace given as a /run/netns name or a path
+ * Returns file descriptor on success, -1 on failure
+ */
+static int open_netns(const char *netns) {
+    char path[512];
+
+    if (netns[0] == '/') {
+        snprintf(path, sizeof(path), "%s", netns);
+    } else {
+        snprintf(path, sizeof(path), "/run/netns/%s", netns);
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_message(LOG_ERR, "Cannot open network namespace %s: %s", path, strerror(errno));
+    }
+    return fd;
+}
+
+/**
+ * Move a PCI device's netdev to another network namespace and/or rename it
+ * Both happen in one RTM_SETLINK, so the device never appears in the target
+ * namespace under its old name. netns is a pid, a /run/netns name or a path;
+ * either netns or ifname may be empty.
+ * Returns 0 on success, -1 on failure
+ */
+int move_pci_netdev(const char *pci_addr, const char *netns, const char *ifname) {
+    char buf[256];
+    int ns_fd = -1;
+
+    int ifindex = get_pci_ifindex(pci_addr);
+    if (ifindex <= 0) {
+        log_message(LOG_ERR, "Cannot find network interface for PCI device %s", pci_addr);
+        return -1;
+    }
+
+    struct nlmsghdr *nlh = nl_msg_init(buf, sizeof(buf), RTM_SETLINK, NLM_F_REQUEST,
+                                       sizeof(struct ifinfomsg));
+    struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_index = ifindex;
+
+    if (netns[0] && strspn(netns, "0123456789") == strlen(netns)) {
+        nl_attr_put_u32(nlh, sizeof(buf), IFLA_NET_NS_PID, (uint32_t)atoi(netns));
+    } else if (netns[0]) {
+        ns_fd = open_netns(netns);
+        if (ns_fd < 0) {
+            return -1;
+        }
+        nl_attr_put_u32(nlh, sizeof(buf), IFLA_NET_NS_FD, ns_fd);
+    }
+    if (ifname[0]) {
+        nl_attr_put_str(nlh, sizeof(buf), IFLA_IFNAME, ifname);
+    }
+
+    int result = -EIO;
+    int fd = nl_open(NETLINK_ROUTE);
+    if (fd >= 0) {
+        result = nl_transact(fd, nlh);
+        close(fd);
+    }
+    if (ns_fd >= 0) {
+        close(ns_fd);
+    }
+
+    if (result != 0) {
+        log_message(LOG_ERR, "Failed to move netdev of %s to netns '%s' as '%s': %s",
+                   pci_addr, netns, ifname, strerror(-result));
+        return -1;
+    }
+
+    log_message(LOG_INFO, "Moved netdev of %s to netns '%s' as '%s'", pci_addr,
+               netns[0] ? netns : "(host)", ifname[0] ? ifname : "(unchanged)");
+    return 0;
+}
+
+/**
+ * Set the MTU of a PCI device's netdev (PF or VF)
+ * Returns 0 on success, -1 on failure
+ */
+int set_pci_mtu(const char *pci_addr, int mtu) {
+    char buf[256];
+
+    int ifindex = get_pci_ifindex(pci_addr);
+    if (ifindex <= 0) {
+        log_message(LOG_ERR, "Cannot find network interface for PCI device %s", pci_addr);
+        return -1;
+    }
+
+    struct nlmsghdr *nlh = nl_msg_init(buf, sizeof(buf), RTM_SETLINK, NLM_F_REQUEST,
+                                       sizeof(struct ifinfomsg));
+    struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_index = ifindex;
+    nl_attr_put_u32(nlh, sizeof(buf), IFLA_MTU, mtu);
+
+    int fd = nl_open(NETLINK_ROUTE);
+    if (fd < 0) {
+        return -1;
+    }
+    int result = nl_transact(fd, nlh);
+    close(fd);
+
+    if (result != 0) {
+        log_message(LOG_ERR, "Failed to set MTU %d on %s: %s", mtu, pci_addr, strerror(-result));
+        return -1;
+    }
+
+    log_message(LOG_INFO, "Set MTU %d on %s", mtu, pci_addr);
+    return 0;
+}
+
+/**
+ * Enable promiscuous mode on the network interface of a PCI device
+ * Returns 0 on success, -1 on failure
+ */
+int enable_promiscuous_mode(const char *pci_addr) {
+    char buf[256];
+
+    int ifindex = get_pci_ifindex(pci_addr);
+    if (ifindex <= 0) {
+        log_message(LOG_ERR, "Cannot find network interface for PCI device %s", pci_addr);
+        return -1;
+    }
+
+    struct nlmsghdr *nlh = nl_msg_init(buf, sizeof(buf), RTM_SETLINK, NLM_F_REQUEST,
+                                       sizeof(struct ifinfomsg));
+    struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_index = ifindex;
+    ifi->ifi_flags = IFF_PROMISC;
+    ifi->ifi_change = IFF_PROMISC;
+
+    int fd = nl_open(NETLINK_ROUTE);
+    if (fd < 0) {
+        return -1;
+    }
+    int result = nl_transact(fd, nlh);
+    close(fd);
+
+    if (result != 0) {
+        log_message(LOG_ERR, "Failed to enable promiscuous mode on %s: %s",
+                   pci_addr, strerror(-result));
+        return -1;
+    }
+
+    log_message(LOG_INFO, "Enabled promiscuous mode on %s", pci_addr);
+    return 0;
+}
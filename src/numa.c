@@ -0,0 +1,246 @@
+/**
+ * viod - SR-IOV Virtual Function daemon
+ *
+ * NUMA and vfio preparation implementation
+ * Reserves hugepages on the NUMA node of each PF that asks for them and checks
+ * that VFs handed to vfio-pci sit in IOMMU groups a userspace driver can use.
+ */
+#include "viod.h"
+
+#define HUGEPAGE_SYSFS "/sys/kernel/mm/hugepages"
+#define NODE_SYSFS "/sys/devices/system/node"
+
+/* Hugepages wanted on one node for one page size */
+typedef struct {
+    int node;                       /**< NUMA node, -1 for a non-NUMA system */
+    int page_kb;                    /**< Page size in kB */
+    long pages;                     /**< Sum requested by all PFs on the node */
+} hugepage_demand_t;
+
+/**
+ * Read the NUMA node of a PCI device
+ * Returns the node, or -1 if the platform does not report one
+ */
+int pci_numa_node(const char *pci_addr) {
+    char path[512];
+    int node = -1;
+
+    snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/numa_node", pci_addr);
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    if (fscanf(file, "%d", &node) != 1) {
+        node = -1;
+    }
+    fclose(file);
+    return node;
+}
+
+/**
+ * Read the IOMMU group of a PCI device
+ * Returns the group number, or -1 if the device is not behind an IOMMU
+ */
+int pci_iommu_group(const char *pci_addr) {
+    char path[512];
+    char target[512];
+
+    snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/iommu_group", pci_addr);
+    ssize_t len = readlink(path, target, sizeof(target) - 1);
+    if (len <= 0) {
+        return -1;
+    }
+    target[len] = '\0';
+
+    char *group = strrchr(target, '/');
+    return atoi(group ? group + 1 : target);
+}
+
+/**
+ * Check whether the kernel has an IOMMU with groups (required by vfio-pci)
+ */
+int iommu_enabled(void) {
+    DIR *dir = opendir("/sys/kernel/iommu_groups");
+    struct dirent *entry;
+    int groups = 0;
+
+    if (!dir) {
+        return 0;
+    }
+    while ((entry = readdir(dir)) != NULL && !groups) {
+        groups = entry->d_name[0] != '.';
+    }
+    closedir(dir);
+    return groups;
+}
+
+/**
+ * Check whether a hugepage size is supported by the kernel
+ */
+int hugepage_size_supported(int page_kb) {
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/hugepages-%dkB", HUGEPAGE_SYSFS, page_kb);
+    return access(path, F_OK) == 0;
+}
+
+/**
+ * Check that a VF's IOMMU group can be handed to userspace
+ * vfio requires every device in the group to be bound to vfio-pci, pci-stub
+ * or no driver at all; a VF sharing a group with its PF (no ACS) never is.
+ * Returns 0 if the group is viable, -1 otherwise
+ */
+int vfio_group_viable(const char *vf_pci_addr) {
+    char path[512];
+    char target[512];
+    struct dirent *entry;
+    int viable = 1;
+
+    int group = pci_iommu_group(vf_pci_addr);
+    if (group < 0) {
+        log_message(LOG_ERR, "VF %s has no IOMMU group, vfio-pci cannot use it", vf_pci_addr);
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "/sys/kernel/iommu_groups/%d/devices", group);
+    DIR *dir = opendir(path);
+    if (!dir) {
+        log_message(LOG_ERR, "Cannot list IOMMU group %d: %s", group, strerror(errno));
+        return -1;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' || strcmp(entry->d_name, vf_pci_addr) == 0) continue;
+
+        snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/driver", entry->d_name);
+        ssize_t len = readlink(path, target, sizeof(target) - 1);
+        if (len <= 0) continue; /* No driver bound */
+        target[len] = '\0';
+
+        char *driver = strrchr(target, '/');
+        driver = driver ? driver + 1 : target;
+        if (strcmp(driver, "vfio-pci") != 0 && strcmp(driver, "pci-stub") != 0) {
+            log_message(LOG_ERR, "IOMMU group %d of VF %s also holds %s bound to %s",
+                       group, vf_pci_addr, entry->d_name, driver);
+            viable = 0;
+        }
+    }
+    closedir(dir);
+
+    if (viable) {
+        log_message(LOG_DEBUG, "IOMMU group %d of VF %s is viable for vfio", group, vf_pci_addr);
+    }
+    return viable ? 0 : -1;
+}
+
+/**
+ * Path of the nr_hugepages knob for a node (or the global pool if node < 0)
+ */
+static void hugepage_path(int node, int page_kb, char *path, size_t size) {
+    if (node < 0) {
+        snprintf(path, size, "%s/hugepages-%dkB/nr_hugepages", HUGEPAGE_SYSFS, page_kb);
+    } else {
+        snprintf(path, size, "%s/node%d/hugepages/hugepages-%dkB/nr_hugepages",
+                 NODE_SYSFS, node, page_kb);
+    }
+}
+
+static long read_hugepages(const char *path) {
+    long pages = -1;
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    if (fscanf(file, "%ld", &pages) != 1) {
+        pages = -1;
+    }
+    fclose(file);
+    return pages;
+}
+
+/**
+ * Grow one node's hugepage pool to at least pages
+ * Pools are never shrunk, since pages may be in use by running tenants.
+ */
+static void reserve_node_hugepages(const hugepage_demand_t *demand) {
+    char path[512];
+    char value[32];
+
+    hugepage_path(demand->node, demand->page_kb, path, sizeof(path));
+    long current = read_hugepages(path);
+    if (current < 0) {
+        log_message(LOG_ERR, "Cannot read %s: %s", path, strerror(errno));
+        return;
+    }
+    if (current >= demand->pages) {
+        log_message(LOG_DEBUG, "Node %d already has %ld %dkB hugepages (%ld wanted)",
+                   demand->node, current, demand->page_kb, demand->pages);
+        return;
+    }
+
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        log_message(LOG_ERR, "Cannot open %s: %s", path, strerror(errno));
+        return;
+    }
+    snprintf(value, sizeof(value), "%ld", demand->pages);
+    ssize_t len = strlen(value);
+    if (write(fd, value, len) != len) {
+        log_message(LOG_ERR, "Cannot write to %s: %s", path, strerror(errno));
+    }
+    close(fd);
+
+    /* The kernel allocates what it can; fragmented memory yields fewer pages */
+    long reserved = read_hugepages(path);
+    if (reserved < demand->pages) {
+        log_message(LOG_WARNING, "Only %ld of %ld %dkB hugepages reserved on node %d",
+                   reserved, demand->pages, demand->page_kb, demand->node);
+    } else {
+        log_message(LOG_INFO, "Reserved %ld %dkB hugepages on node %d",
+                   reserved, demand->page_kb, demand->node);
+    }
+}
+
+/**
+ * Reserve the hugepages requested by a set of validated PFs on their NUMA nodes
+ * Requests of PFs sharing a node and page size are added up, so the set must
+ * include PFs that are already applied as well as those about to be.
+ */
+void reserve_hugepages(const pf_config_t *const *configs, size_t config_count) {
+    hugepage_demand_t *demands = NULL;
+    size_t count = 0;
+
+    for (size_t i = 0; i < config_count; i++) {
+        const pf_config_t *config = configs[i];
+        if (config->hugepages <= 0 || config->hugepage_kb <= 0) continue;
+
+        if (!demands) {
+            demands = calloc(config_count, sizeof(hugepage_demand_t));
+            if (!demands) {
+                log_message(LOG_ERR, "Failed to allocate memory for hugepage reservations");
+                return;
+            }
+        }
+
+        int node = pci_numa_node(config->name);
+        size_t d;
+        for (d = 0; d < count; d++) {
+            if (demands[d].node == node && demands[d].page_kb == config->hugepage_kb) break;
+        }
+        if (d == count) {
+            demands[count].node = node;
+            demands[count].page_kb = config->hugepage_kb;
+            count++;
+        }
+        demands[d].pages += config->hugepages;
+    }
+
+    for (size_t d = 0; d < count; d++) {
+        int span = trace_begin("hugepages", "node%d %dkB %ld", demands[d].node,
+                               demands[d].page_kb, demands[d].pages);
+        reserve_node_hugepages(&demands[d]);
+        trace_end(span);
+    }
+    free(demands);
+}
@@ -0,0 +1,567 @@
+/**
+ * viod - SR-IOV Virtual Function daemon
+ *
+ * PF capability probe implementation
+ * Probes and caches what each PF can do (SR-IOV support, VF limit, driver,
+ * netdev, eswitch mode) and validates configurations against it before any
+ * destructive step. Cache entries are dropped when the kernel reports a
+ * uevent for the device.
+ */
+#include "viod.h"
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/utsname.h>
+#include <linux/genetlink.h>
+#include <linux/devlink.h>
+
+static pf_caps_t *cache = NULL;
+static size_t cache_count = 0;
+static size_t cache_capacity = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* devlink generic netlink family: 0 = not resolved yet, -1 = unavailable */
+static int devlink_family = 0;
+
+/**
+ * Read an integer from a sysfs file
+ * Returns 0 on success, -1 on failure
+ */
+static int read_sysfs_int(const char *path, int *value) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    int result = fscanf(file, "%d", value) == 1 ? 0 : -1;
+    fclose(file);
+    return result;
+}
+
+static void genl_family_cb(struct nlmsghdr *nlh, void *ctx) {
+    struct rtattr *tb[CTRL_ATTR_MAX + 1];
+
+    nl_parse_attrs(tb, CTRL_ATTR_MAX, (struct rtattr *)((char *)NLMSG_DATA(nlh) + GENL_HDRLEN),
+                   nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+    if (tb[CTRL_ATTR_FAMILY_ID]) {
+        *(int *)ctx = *(uint16_t *)RTA_DATA(tb[CTRL_ATTR_FAMILY_ID]);
+    }
+}
+
+static void eswitch_mode_cb(struct nlmsghdr *nlh, void *ctx) {
+    struct rtattr *tb[DEVLINK_ATTR_MAX + 1];
+
+    nl_parse_attrs(tb, DEVLINK_ATTR_MAX, (struct rtattr *)((char *)NLMSG_DATA(nlh) + GENL_HDRLEN),
+                   nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+    if (tb[DEVLINK_ATTR_ESWITCH_MODE]) {
+        uint16_t mode = *(uint16_t *)RTA_DATA(tb[DEVLINK_ATTR_ESWITCH_MODE]);
+        *(eswitch_mode_t *)ctx = mode == DEVLINK_ESWITCH_MODE_SWITCHDEV ?
+                                 ESWITCH_MODE_SWITCHDEV : ESWITCH_MODE_LEGACY;
+    }
+}
+
+/**
+ * Query the eswitch mode of a PF through devlink
+ * Returns ESWITCH_MODE_UNKNOWN if devlink or the device does not report one
+ */
+static eswitch_mode_t probe_eswitch_mode(const char *pci_addr) {
+    char buf[256];
+    eswitch_mode_t mode = ESWITCH_MODE_UNKNOWN;
+    struct genlmsghdr *genl;
+
+    int fd = nl_open(NETLINK_GENERIC);
+    if (fd < 0) {
+        return mode;
+    }
+
+    if (devlink_family == 0) {
+        int family = -1;
+        struct nlmsghdr *nlh = nl_msg_init(buf, sizeof(buf), GENL_ID_CTRL, NLM_F_REQUEST, GENL_HDRLEN);
+        genl = NLMSG_DATA(nlh);
+        genl->cmd = CTRL_CMD_GETFAMILY;
+        genl->version = 1;
+        nl_attr_put_str(nlh, sizeof(buf), CTRL_ATTR_FAMILY_NAME, DEVLINK_GENL_NAME);
+        if (nl_request(fd, nlh, genl_family_cb, &family) != 0) {
+            family = -1;
+        }
+        devlink_family = family;
+    }
+
+    if (devlink_family > 0) {
+        struct nlmsghdr *nlh = nl_msg_init(buf, sizeof(buf), devlink_family, NLM_F_REQUEST, GENL_HDRLEN);
+        genl = NLMSG_DATA(nlh);
+        genl->cmd = DEVLINK_CMD_ESWITCH_GET;
+        genl->version = DEVLINK_GENL_VERSION;
+        nl_attr_put_str(nlh, sizeof(buf), DEVLINK_ATTR_BUS_NAME, "pci");
+        nl_attr_put_str(nlh, sizeof(buf), DEVLINK_ATTR_DEV_NAME, pci_addr);
+        nl_request(fd, nlh, eswitch_mode_cb, &mode);
+    }
+
+    close(fd);
+    return mode;
+}
+
+/**
+ * Read an integer in hex (e.g. PCI "0x8086") from a sysfs file
+ * Returns 0 on success, -1 on failure
+ */
+static int read_sysfs_hex(const char *path, unsigned int *value) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    int result = fscanf(file, "%x", value) == 1 ? 0 : -1;
+    fclose(file);
+    return result;
+}
+
+/**
+ * Fill in the sysfs-visible capabilities of a PF (everything but devlink)
+ */
+static void read_pf_sysfs(const char *pci_addr, pf_caps_t *caps) {
+    char path[512];
+    char target[512];
+
+    memset(caps, 0, sizeof(*caps));
+    strncpy(caps->pci_addr, pci_addr, sizeof(caps->pci_addr) - 1);
+
+    snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s", pci_addr);
+    caps->present = access(path, F_OK) == 0;
+    if (!caps->present) {
+        return;
+    }
+
+    snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/sriov_totalvfs", pci_addr);
+    caps->sriov_capable = read_sysfs_int(path, &caps->total_vfs) == 0;
+
+    snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/vendor", pci_addr);
+    read_sysfs_hex(path, &caps->vendor);
+    snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/device", pci_addr);
+    read_sysfs_hex(path, &caps->device);
+
+    snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/sriov_numvfs", pci_addr);
+    read_sysfs_int(path, &caps->num_vfs);
+
+    snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/driver", pci_addr);
+    ssize_t len = readlink(path, target, sizeof(target) - 1);
+    if (len > 0) {
+        target[len] = '\0';
+        char *name = strrchr(target, '/');
+        strncpy(caps->driver, name ? name + 1 : target, sizeof(caps->driver) - 1);
+    }
+
+    get_pci_interface(pci_addr, caps->ifname, sizeof(caps->ifname));
+    caps->numa_node = pci_numa_node(pci_addr);
+}
+
+/**
+ * Probe a PF from sysfs and devlink, bypassing the cache
+ */
+static void probe_pf_uncached(const char *pci_addr, pf_caps_t *caps) {
+    read_pf_sysfs(pci_addr, caps);
+    if (!caps->present) {
+        return;
+    }
+
+    caps->eswitch_mode = probe_eswitch_mode(pci_addr);
+
+    log_message(LOG_INFO, "Probed PF %s: sriov=%s totalvfs=%d driver=%s netdev=%s numa=%d eswitch=%s",
+               pci_addr, caps->sriov_capable ? "yes" : "no", caps->total_vfs,
+               caps->driver[0] ? caps->driver : "none", caps->ifname[0] ? caps->ifname : "none",
+               caps->numa_node, eswitch_mode_name(caps->eswitch_mode));
+}
+
+const char *eswitch_mode_name(eswitch_mode_t mode) {
+    switch (mode) {
+        case ESWITCH_MODE_LEGACY:    return "legacy";
+        case ESWITCH_MODE_SWITCHDEV: return "switchdev";
+        default:                     return "unknown";
+    }
+}
+
+/**
+ * Get the capabilities of a PF, probing it if not cached
+ * Returns 0 on success, -1 on invalid PCI address or allocation failure
+ */
+int probe_pf(const char *pf_name, pf_caps_t *caps) {
+    char pci_addr[64];
+
+    if (normalize_pci_address(pf_name, pci_addr, sizeof(pci_addr)) != 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    for (size_t i = 0; i < cache_count; i++) {
+        if (strcmp(cache[i].pci_addr, pci_addr) == 0) {
+            *caps = cache[i];
+            pthread_mutex_unlock(&cache_lock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    probe_pf_uncached(pci_addr, caps);
+
+    pthread_mutex_lock(&cache_lock);
+    if (cache_count >= cache_capacity) {
+        size_t capacity = cache_capacity ? cache_capacity * 2 : 16;
+        pf_caps_t *grown = realloc(cache, capacity * sizeof(pf_caps_t));
+        if (!grown) {
+            pthread_mutex_unlock(&cache_lock);
+            log_message(LOG_ERR, "Failed to allocate memory for PF capabilities");
+            return 0; /* Result is still valid, just not cached */
+        }
+        cache = grown;
+        cache_capacity = capacity;
+    }
+    cache[cache_count++] = *caps;
+    pthread_mutex_unlock(&cache_lock);
+
+    return 0;
+}
+
+/**
+ * Drop cached capabilities for a PF, or for all PFs if pci_addr is NULL
+ */
+void probe_invalidate(const char *pci_addr) {
+    pthread_mutex_lock(&cache_lock);
+    size_t i = 0;
+    while (i < cache_count) {
+        if (!pci_addr || strcmp(cache[i].pci_addr, pci_addr) == 0) {
+            cache[i] = cache[--cache_count];
+        } else {
+            i++;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void probe_cleanup(void) {
+    pthread_mutex_lock(&cache_lock);
+    free(cache);
+    cache = NULL;
+    cache_count = cache_capacity = 0;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/**
+ * Scan sysfs once for every SR-IOV capable PF on the host
+ * Used to expand PF selectors; devlink is not queried here.
+ * Returns 0 on success with *pfs allocated (free with free()), -1 on failure
+ */
+int pci_scan_pfs(pf_caps_t **pfs, size_t *count) {
+    size_t capacity = 16;
+    struct dirent *entry;
+
+    *count = 0;
+    *pfs = malloc(capacity * sizeof(pf_caps_t));
+    if (!*pfs) {
+        log_message(LOG_ERR, "Failed to allocate memory for PCI scan");
+        return -1;
+    }
+
+    DIR *dir = opendir("/sys/bus/pci/devices");
+    if (!dir) {
+        log_message(LOG_ERR, "Cannot scan PCI devices: %s", strerror(errno));
+        free(*pfs);
+        *pfs = NULL;
+        return -1;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+
+        pf_caps_t caps;
+        read_pf_sysfs(entry->d_name, &caps);
+        if (!caps.sriov_capable) continue;
+
+        if (*count >= capacity) {
+            capacity *= 2;
+            pf_caps_t *grown = realloc(*pfs, capacity * sizeof(pf_caps_t));
+            if (!grown) {
+                log_message(LOG_ERR, "Failed to allocate memory for PCI scan");
+                break;
+            }
+            *pfs = grown;
+        }
+        (*pfs)[(*count)++] = caps;
+    }
+    closedir(dir);
+
+    log_message(LOG_INFO, "Found %zu SR-IOV capable PF(s)", *count);
+    return 0;
+}
+
+/**
+ * Check whether a PCI driver is loaded or can be loaded as a module
+ * Returns 1 if available, 0 otherwise
+ */
+int driver_available(const char *driver) {
+    static const char *const module_lists[] = { "modules.dep", "modules.builtin" };
+    char path[512];
+    char line[MAX_LINE_LEN];
+    struct utsname uts;
+
+    snprintf(path, sizeof(path), "/sys/bus/pci/drivers/%s", driver);
+    if (access(path, F_OK) == 0) {
+        return 1;
+    }
+
+    if (uname(&uts) != 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < sizeof(module_lists) / sizeof(module_lists[0]); i++) {
+        snprintf(path, sizeof(path), "/lib/modules/%s/%s", uts.release, module_lists[i]);
+        FILE *file = fopen(path, "r");
+        if (!file) continue;
+
+        while (fgets(line, sizeof(line), file)) {
+            /* "kernel/drivers/vfio/pci/vfio-pci.ko.zst: deps..." -> "vfio-pci" */
+            line[strcspn(line, ":\n")] = '\0';
+            char *name = strrchr(line, '/');
+            name = name ? name + 1 : line;
+            char *ext = strstr(name, ".ko");
+            if (ext) *ext = '\0';
+
+            /* Module names treat '-' and '_' as equivalent */
+            const char *a = name, *b = driver;
+            while (*a && *b && (*a == *b || ((*a == '-' || *a == '_') && (*b == '-' || *b == '_')))) {
+                a++;
+                b++;
+            }
+            if (*a == '\0' && *b == '\0') {
+                fclose(file);
+                return 1;
+            }
+        }
+        fclose(file);
+    }
+
+    return 0;
+}
+
+/**
+ * Check whether a host netdev other than a VF of the PF already has a name
+ * This PF's own VFs are recreated before they are renamed, so they do not count.
+ */
+static int host_ifname_taken(const char *ifname, const char *pf_pci_addr) {
+    char path[512];
+    char target[512];
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s", ifname);
+    if (access(path, F_OK) != 0) {
+        return 0;
+    }
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/physfn", ifname);
+    ssize_t len = readlink(path, target, sizeof(target) - 1);
+    if (len <= 0) {
+        return 1;
+    }
+    target[len] = '\0';
+
+    char *physfn = strrchr(target, '/');
+    return strcmp(physfn ? physfn + 1 : target, pf_pci_addr) != 0;
+}
+
+/**
+ * Validate a PF configuration against the probed PF capabilities
+ * Called before any destructive step; logs every reason for rejection.
+ * Returns 0 if the configuration can be applied, -1 otherwise
+ */
+int validate_pf_config(const pf_config_t *config) {
+    pf_caps_t caps;
+    int valid = 1;
+
+    if (probe_pf(config->name, &caps) != 0) {
+        log_message(LOG_ERR, "Invalid PF address %s in %s", config->name, config->config_file);
+        return -1;
+    }
+    if (!caps.present) {
+        log_message(LOG_ERR, "PCI device %s not found", caps.pci_addr);
+        return -1;
+    }
+    if (!caps.sriov_capable) {
+        log_message(LOG_ERR, "PCI device %s is not SR-IOV capable", caps.pci_addr);
+        return -1;
+    }
+
+    if (config->num_vfs < 0 || config->num_vfs > caps.total_vfs || config->num_vfs > MAX_VFS) {
+        log_message(LOG_ERR, "%s requests %d VFs but %s supports at most %d",
+                   config->config_file, config->num_vfs, caps.pci_addr,
+                   caps.total_vfs < MAX_VFS ? caps.total_vfs : MAX_VFS);
+        valid = 0;
+    }
+
+    if (config->kind == DEVICE_KIND_NET && caps.ifname[0] == '\0') {
+        log_message(LOG_ERR, "Network PF %s has no network interface", caps.pci_addr);
+        valid = 0;
+    }
+
+    if (config->hugepages < 0 || (config->hugepages > 0 && !hugepage_size_supported(config->hugepage_kb))) {
+        log_message(LOG_ERR, "%s requests %d hugepages of %dkB, not supported by the kernel",
+                   config->config_file, config->hugepages, config->hugepage_kb);
+        valid = 0;
+    }
+
+    /* VFs cannot exceed the PF MTU; the current one applies if none is configured */
+    int pf_mtu = config->mtu;
+    if (config->kind == DEVICE_KIND_NET && config->mtu != 0 && config->mtu < MIN_MTU) {
+        log_message(LOG_ERR, "%s sets PF MTU %d, below the minimum of %d",
+                   config->config_file, config->mtu, MIN_MTU);
+        valid = 0;
+    }
+    if (config->kind == DEVICE_KIND_NET && pf_mtu <= 0 && caps.ifname[0]) {
+        char path[512];
+        snprintf(path, sizeof(path), "/sys/class/net/%s/mtu", caps.ifname);
+        if (read_sysfs_int(path, &pf_mtu) != 0) {
+            pf_mtu = 0;
+        }
+    }
+
+    int num_vfs = config->num_vfs < MAX_VFS ? config->num_vfs : MAX_VFS;
+    for (int i = 0; i < num_vfs; i++) {
+        const vf_config_t *vf = &config->vfs[i];
+
+        if (config->kind == DEVICE_KIND_NET && vf->mtu != 0) {
+            if (vf->mtu < MIN_MTU || (pf_mtu > 0 && vf->mtu > pf_mtu)) {
+                log_message(LOG_ERR, "VF %d of %s sets MTU %d, must be between %d and the PF MTU %d",
+                           i, caps.pci_addr, vf->mtu, MIN_MTU, pf_mtu);
+                valid = 0;
+            }
+            /* The MTU is set on the VF netdev, which vfio-pci does not create */
+            if (strcmp(vf->driver, "vfio-pci") == 0) {
+                log_message(LOG_ERR, "VF %d of %s sets mtu but is bound to vfio-pci",
+                           i, caps.pci_addr);
+                valid = 0;
+            }
+        }
+
+        if ((vf->netns[0] || vf->ifname[0]) &&
+            (config->kind != DEVICE_KIND_NET || strcmp(vf->driver, "vfio-pci") == 0)) {
+            log_message(LOG_ERR, "VF %d of %s sets netns/ifname but has no host netdev",
+                       i, caps.pci_addr);
+            valid = 0;
+        }
+
+        /* A rename in the host namespace must not clash; the target namespace
+         * of a move cannot be checked from here */
+        if (vf->ifname[0] && !vf->netns[0] && host_ifname_taken(vf->ifname, caps.pci_addr)) {
+            log_message(LOG_ERR, "VF %d of %s is renamed to %s, which a host netdev already uses",
+                       i, caps.pci_addr, vf->ifname);
+            valid = 0;
+        }
+        for (int j = 0; j < i && vf->ifname[0]; j++) {
+            if (strcmp(config->vfs[j].ifname, vf->ifname) == 0 &&
+                strcmp(config->vfs[j].netns, vf->netns) == 0) {
+                log_message(LOG_ERR, "VFs %d and %d of %s are both named %s",
+                           j, i, caps.pci_addr, vf->ifname);
+                valid = 0;
+            }
+        }
+
+        if (vf->driver[0] && !driver_available(vf->driver)) {
+            log_message(LOG_ERR, "Driver %s for VF %d of %s is not available",
+                       vf->driver, i, caps.pci_addr);
+            valid = 0;
+        }
+
+        if (config->kind != DEVICE_KIND_GPU && gpu_profile_set(&vf->gpu)) {
+            log_message(LOG_ERR, "VF %d of %s sets GPU resources but the PF is not kind = gpu",
+                       i, caps.pci_addr);
+            valid = 0;
+        }
+
+        if (strcmp(vf->driver, "vfio-pci") == 0 && !iommu_enabled()) {
+            log_message(LOG_ERR, "VF %d of %s uses vfio-pci but no IOMMU is enabled",
+                       i, caps.pci_addr);
+            valid = 0;
+        }
+
+        if (config->kind == DEVICE_KIND_NET &&
+            (vf->vlan < 0 || vf->vlan > 4095 || vf->vlan_qos < 0 || vf->vlan_qos > 7)) {
+            log_message(LOG_ERR, "VF %d of %s sets vlan %d qos %d, must be 0-4095 and 0-7",
+                       i, caps.pci_addr, vf->vlan, vf->vlan_qos);
+            valid = 0;
+        }
+
+        /* Legacy per-VF VLAN, link state and flags are not offered in switchdev mode */
+        if (config->kind == DEVICE_KIND_NET && caps.eswitch_mode == ESWITCH_MODE_SWITCHDEV &&
+            (vf->vlan > 0 || vf->vlan_qos > 0 || vf->link_state != VF_LINK_STATE_UNSET ||
+             vf->trust != VF_FLAG_UNSET || vf->spoofchk != VF_FLAG_UNSET ||
+             vf->query_rss != VF_FLAG_UNSET)) {
+            log_message(LOG_ERR, "VF %d of %s sets vlan/link_state/trust/spoofchk/query_rss, "
+                       "unsupported in switchdev mode", i, caps.pci_addr);
+            valid = 0;
+        }
+    }
+
+    if (!valid) {
+        log_message(LOG_ERR, "Rejecting configuration %s, keeping running VFs of %s",
+                   config->config_file, caps.pci_addr);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Open a socket receiving kernel uevents
+ * Returns file descriptor on success, -1 on failure
+ */
+int uevent_open(void) {
+    struct sockaddr_nl addr;
+
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0) {
+        log_message(LOG_ERR, "Cannot open uevent socket: %s", strerror(errno));
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1; /* Kernel broadcast group */
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        log_message(LOG_ERR, "Cannot bind uevent socket: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Drain pending uevents and invalidate cached PFs they refer to
+ * A uevent refers to a PF when the PF address is a component of its DEVPATH
+ * (the PF itself, its driver binding, its netdev or one of its VFs).
+ */
+void uevent_handle(int fd) {
+    char buf[8192];
+    ssize_t len;
+
+    while ((len = recv(fd, buf, sizeof(buf) - 1, 0)) > 0) {
+        buf[len] = '\0';
+
+        const char *devpath = NULL;
+        for (char *p = buf; p < buf + len; p += strlen(p) + 1) {
+            if (strncmp(p, "DEVPATH=", 8) == 0) {
+                devpath = p + 8;
+                break;
+            }
+        }
+        if (!devpath) continue;
+
+        pthread_mutex_lock(&cache_lock);
+        size_t i = 0;
+        while (i < cache_count) {
+            const char *match = strstr(devpath, cache[i].pci_addr);
+            size_t addr_len = strlen(cache[i].pci_addr);
+            if (match && match > devpath && match[-1] == '/' &&
+                (match[addr_len] == '/' || match[addr_len] == '\0')) {
+                log_message(LOG_DEBUG, "uevent for %s, refreshing PF capabilities", cache[i].pci_addr);
+                cache[i] = cache[--cache_count];
+            } else {
+                i++;
+            }
+        }
+        pthread_mutex_unlock(&cache_lock);
+    }
+}
@@ -0,0 +1,444 @@
+/**
+ * viod - SR-IOV Virtual Function daemon
+ *
+ * Reconcile worker implementation
+ * Applies configurations on a dedicated thread so the main loop keeps handling
+ * events. Submitted configuration generations coalesce: only the newest one is
+ * kept, PFs whose target is unchanged are skipped, and not-yet-started steps of
+ * a PF are cancelled as soon as a newer generation changes that PF.
+ *
+ * Applied digests are saved to STATE_PATH, so a daemon started after
+ * `viod --oneshot` (or restarted) adopts PFs that are already configured
+ * instead of recreating their VFs.
+ */
+#include "viod.h"
+#include <pthread.h>
+
+#define STATE_VERSION 2             /* Format of STATE_PATH and its digests */
+
+/* Digest of a PF configuration that has been successfully applied */
+typedef struct {
+    char name[MAX_NAME_LEN];        /**< PF PCI address as configured */
+    uint64_t digest;                /**< config_digest() of the applied config */
+} applied_pf_t;
+
+static pthread_t worker;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond;
+
+/* Protected by lock */
+static config_list_t pending = {0};
+static int has_pending = 0;
+static int stopping = 0;
+static unsigned long submitted_gen = 0;
+
+/* Owned by the worker thread */
+static config_list_t active = {0};  /* Last reconciled generation, used by retries */
+static applied_pf_t *applied = NULL;
+static size_t applied_count = 0;
+static size_t applied_capacity = 0;
+
+/**
+ * Fold bytes into an FNV-1a hash
+ */
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *p = data;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* Strings are hashed with their terminator so "ab","c" differs from "a","bc" */
+#define DIGEST_INT(hash, value) ((hash) = fnv1a((hash), &(value), sizeof(value)))
+#define DIGEST_STR(hash, str) ((hash) = fnv1a((hash), (str), strlen(str) + 1))
+
+/**
+ * FNV-1a digest of the settings that make up a PF's target state
+ * Only fields that are applied to the hardware are hashed, and only for the
+ * VFs that are created, so the digest does not depend on struct padding,
+ * the source file name or unused [vfN] sections.
+ */
+static uint64_t config_digest(const pf_config_t *config) {
+    uint64_t hash = 1469598103934665603ULL;
+
+    DIGEST_STR(hash, config->name);
+    DIGEST_INT(hash, config->kind);
+    DIGEST_INT(hash, config->num_vfs);
+    DIGEST_INT(hash, config->promisc);
+    DIGEST_INT(hash, config->mtu);
+    DIGEST_INT(hash, config->hugepages);
+    DIGEST_INT(hash, config->hugepage_kb);
+
+    for (int i = 0; i < config->num_vfs && i < MAX_VFS; i++) {
+        const vf_config_t *vf = &config->vfs[i];
+
+        DIGEST_STR(hash, vf->driver);
+        DIGEST_STR(hash, vf->mac);
+        DIGEST_INT(hash, vf->vlan);
+        DIGEST_INT(hash, vf->vlan_qos);
+        DIGEST_INT(hash, vf->vlan_proto);
+        DIGEST_INT(hash, vf->link_state);
+        DIGEST_INT(hash, vf->mtu);
+        DIGEST_INT(hash, vf->trust);
+        DIGEST_INT(hash, vf->spoofchk);
+        DIGEST_INT(hash, vf->query_rss);
+        DIGEST_INT(hash, vf->gpu.lmem_quota);
+        DIGEST_INT(hash, vf->gpu.exec_quantum_ms);
+        DIGEST_INT(hash, vf->gpu.preempt_timeout_us);
+        DIGEST_STR(hash, vf->netns);
+        DIGEST_STR(hash, vf->ifname);
+    }
+    return hash;
+}
+
+static applied_pf_t *find_applied(const char *name) {
+    for (size_t i = 0; i < applied_count; i++) {
+        if (strcmp(applied[i].name, name) == 0) {
+            return &applied[i];
+        }
+    }
+    return NULL;
+}
+
+static void forget_applied(const char *name) {
+    applied_pf_t *entry = find_applied(name);
+    if (entry) {
+        *entry = applied[--applied_count];
+    }
+}
+
+static void set_applied(const char *name, uint64_t digest) {
+    applied_pf_t *entry = find_applied(name);
+
+    if (!entry) {
+        if (applied_count >= applied_capacity) {
+            size_t capacity = applied_capacity ? applied_capacity * 2 : 16;
+            applied_pf_t *grown = realloc(applied, capacity * sizeof(applied_pf_t));
+            if (!grown) {
+                log_message(LOG_ERR, "Failed to allocate memory for applied state");
+                return;
+            }
+            applied = grown;
+            applied_capacity = capacity;
+        }
+        entry = &applied[applied_count++];
+        strncpy(entry->name, name, MAX_NAME_LEN - 1);
+        entry->name[MAX_NAME_LEN - 1] = '\0';
+    }
+    entry->digest = digest;
+}
+
+/**
+ * inventory_retain() callback: keep entries of adopted PFs only
+ */
+static int is_applied(const char *pf_pci_addr) {
+    return find_applied(pf_pci_addr) != NULL;
+}
+
+/**
+ * Adopt the PFs recorded by a previous run (one-shot or daemon)
+ * The file is ignored unless written with the same digest format; bump the
+ * version whenever config_digest() changes.
+ */
+static void load_state(void) {
+    char line[MAX_LINE_LEN];
+    unsigned int version = 0;
+
+    FILE *file = fopen(STATE_PATH, "r");
+    if (!file) {
+        return;
+    }
+
+    if (!fgets(line, sizeof(line), file) ||
+        sscanf(line, "viod-state %u", &version) != 1 || version != STATE_VERSION) {
+        log_message(LOG_WARNING, "Ignoring %s written by an incompatible viod", STATE_PATH);
+        fclose(file);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        char name[MAX_NAME_LEN];
+        unsigned long long digest;
+        if (sscanf(line, "%255s %llx", name, &digest) == 2) {
+            set_applied(name, digest);
+            log_message(LOG_INFO, "Adopting already applied PF %s", name);
+        }
+    }
+    fclose(file);
+}
+
+/**
+ * Record PFs that are fully applied, for a later run to adopt
+ * PFs with steps still awaiting a retry are left out, so they get re-applied.
+ */
+static void save_state(void) {
+    char tmp_path[512];
+
+    /* Normally created by inventory_open(), which may have failed */
+    if (mkdir(RUNTIME_DIR, 0755) != 0 && errno != EEXIST) {
+        log_message(LOG_ERR, "Failed to create %s: %s", RUNTIME_DIR, strerror(errno));
+        return;
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", STATE_PATH);
+    FILE *file = fopen(tmp_path, "w");
+    if (!file) {
+        log_message(LOG_ERR, "Cannot open %s: %s", tmp_path, strerror(errno));
+        return;
+    }
+
+    fprintf(file, "viod-state %u\n", STATE_VERSION);
+    for (size_t i = 0; i < applied_count; i++) {
+        if (retry_pending_pf(applied[i].name)) continue;
+        fprintf(file, "%s %016llx\n", applied[i].name, (unsigned long long)applied[i].digest);
+    }
+    fclose(file);
+
+    if (rename(tmp_path, STATE_PATH) != 0) {
+        log_message(LOG_ERR, "Cannot replace %s: %s", STATE_PATH, strerror(errno));
+        unlink(tmp_path);
+    }
+}
+
+/**
+ * Drop applied state for PFs that are no longer configured
+ */
+static void prune_applied(const config_list_t *configs) {
+    size_t i = 0;
+    while (i < applied_count) {
+        int present = 0;
+        for (size_t j = 0; j < configs->count; j++) {
+            if (strcmp(configs->configs[j].name, applied[i].name) == 0) {
+                present = 1;
+                break;
+            }
+        }
+        if (present) {
+            i++;
+        } else {
+            applied[i] = applied[--applied_count];
+        }
+    }
+}
+
+/**
+ * Make the next generation re-apply a PF even if its config is unchanged
+ * Used when a failed step has exhausted its retries.
+ */
+void reconcile_invalidate(const char *pf_name) {
+    forget_applied(pf_name);
+}
+
+int reconcile_needed(const pf_config_t *config) {
+    applied_pf_t *entry = find_applied(config->name);
+    return !entry || entry->digest != config_digest(config);
+}
+
+void reconcile_done(const pf_config_t *config, int result) {
+    if (result == 0 && !reconcile_cancelled(config)) {
+        set_applied(config->name, config_digest(config));
+    } else {
+        forget_applied(config->name);
+    }
+}
+
+/**
+ * Check whether the remaining steps for a PF should be abandoned
+ * True when shutting down, or when a newer submitted generation no longer
+ * contains this PF or changes its target configuration.
+ */
+int reconcile_cancelled(const pf_config_t *config) {
+    int cancelled = 0;
+
+    pthread_mutex_lock(&lock);
+    if (stopping) {
+        cancelled = 1;
+    } else if (has_pending) {
+        cancelled = 1;
+        for (size_t i = 0; i < pending.count; i++) {
+            if (strcmp(pending.configs[i].name, config->name) == 0) {
+                cancelled = config_digest(&pending.configs[i]) != config_digest(config);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    return cancelled;
+}
+
+/**
+ * Hand a freshly loaded configuration generation to the worker
+ * Takes ownership of configs and leaves it empty. Any generation that has not
+ * been picked up yet is discarded in favour of this one.
+ */
+void reconcile_submit(config_list_t *configs) {
+    pthread_mutex_lock(&lock);
+    if (has_pending) {
+        log_message(LOG_INFO, "Coalescing pending configuration generation %lu", submitted_gen);
+        cleanup_configs(&pending);
+    }
+    pending = *configs;
+    has_pending = 1;
+    submitted_gen++;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+
+    memset(configs, 0, sizeof(*configs));
+}
+
+/**
+ * Wait until a generation is submitted, a retry is due, or we are stopping
+ * Called and returns with lock held.
+ */
+static void wait_for_work(void) {
+    while (!has_pending && !stopping) {
+        long delay = retry_next_delay_ms();
+        if (delay == 0) {
+            return;
+        }
+        if (delay < 0) {
+            pthread_cond_wait(&cond, &lock);
+            continue;
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += delay / 1000;
+        deadline.tv_nsec += (delay % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&cond, &lock, &deadline);
+    }
+}
+
+static void *reconcile_worker(void *arg) {
+    (void)arg;
+    config_list_t current = {0};
+
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        wait_for_work();
+        if (stopping) {
+            pthread_mutex_unlock(&lock);
+            break;
+        }
+        if (!has_pending) {
+            /* Woken for retries only */
+            pthread_mutex_unlock(&lock);
+            retry_run_due(&active);
+            save_state();
+            continue;
+        }
+        current = pending;
+        memset(&pending, 0, sizeof(pending));
+        has_pending = 0;
+        unsigned long gen = submitted_gen;
+        pthread_mutex_unlock(&lock);
+
+        log_message(LOG_INFO, "Reconciling configuration generation %lu", gen);
+        int span = trace_begin("reconcile", "generation %lu", gen);
+        prune_applied(&current);
+        retry_prune(&current);
+        apply_all_configs(&current);
+        trace_end(span);
+        log_message(LOG_INFO, "Finished generation %lu with %zu configuration(s)", gen, current.count);
+        trace_flush(gen);
+        save_state();
+
+        /* Keep this generation around for retries of its failed steps */
+        cleanup_configs(&active);
+        active = current;
+        memset(&current, 0, sizeof(current));
+    }
+
+    cleanup_configs(&active);
+    return NULL;
+}
+
+/**
+ * Start the reconcile worker thread
+ * Returns 0 on success, -1 on failure
+ */
+int reconcile_start(void) {
+    sigset_t mask, old_mask;
+    pthread_condattr_t attr;
+
+    load_state();
+    inventory_retain(is_applied);
+
+    /* Timed waits for retries use the monotonic clock */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    /* Daemon signals are handled by the main thread only */
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+
+    int err = pthread_create(&worker, NULL, reconcile_worker, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    if (err != 0) {
+        log_message(LOG_ERR, "Failed to start reconcile worker: %s", strerror(err));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Stop the worker, cancelling any in-flight PF, and release its state
+ */
+void reconcile_stop(void) {
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+
+    pthread_join(worker, NULL);
+
+    cleanup_configs(&pending);
+    retry_cleanup();
+    free(applied);
+    applied = NULL;
+    applied_count = applied_capacity = 0;
+}
+
+/**
+ * Apply a configuration generation once on the calling thread (viod --oneshot)
+ * Failed steps are not retried; their PFs are left for the daemon to re-apply.
+ * Returns the number of PFs that were not fully applied
+ */
+int reconcile_oneshot(config_list_t *configs) {
+    int failed = 0;
+
+    load_state();
+    inventory_retain(is_applied);
+    prune_applied(configs);
+
+    int span = trace_begin("reconcile", "%s", "oneshot");
+    apply_all_configs(configs);
+    trace_end(span);
+
+    for (size_t i = 0; i < configs->count; i++) {
+        if (!find_applied(configs->configs[i].name) || retry_pending_pf(configs->configs[i].name)) {
+            log_message(LOG_ERR, "PF %s was not fully applied", configs->configs[i].name);
+            failed++;
+        }
+    }
+
+    save_state();
+    retry_cleanup();
+    free(applied);
+    applied = NULL;
+    applied_count = applied_capacity = 0;
+    return failed;
+}
@@ -0,0 +1,331 @@
+/**
+ * viod - SR-IOV Virtual Function daemon
+ *
+ * Retry scheduler implementation
+ * Tracks failed configuration steps per PF and VF and retries only the failed
+ * step with exponential backoff and jitter. Runs on the reconcile worker
+ * thread, which sleeps until the next retry is due. Failure counters are kept
+ * for as long as the PF is configured and exported to RETRY_METRICS_PATH.
+ */
+#include "viod.h"
+
+#define RETRY_BASE_MS 1000          /* First retry after about one second */
+#define RETRY_MAX_MS 300000         /* Backoff is capped at five minutes */
+#define RETRY_MAX_ATTEMPTS 10       /* Then wait for the next reload */
+
+/* A configuration step that has failed at least once */
+typedef struct {
+    char pf_name[MAX_NAME_LEN];     /**< PF PCI address */
+    int vf_id;                      /**< VF index, -1 for PF-level steps */
+    config_step_t step;             /**< Failed step */
+    int pending;                    /**< Retry scheduled */
+    int attempts;                   /**< Consecutive failures */
+    unsigned long failures;         /**< Failures since the PF was configured */
+    uint64_t next_ms;               /**< Monotonic time of next attempt */
+} retry_entry_t;
+
+static retry_entry_t *entries = NULL;
+static size_t entry_count = 0;
+static size_t entry_capacity = 0;
+static unsigned int seed = 0;
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static retry_entry_t *find_entry(const char *pf_name, int vf_id, config_step_t step) {
+    for (size_t i = 0; i < entry_count; i++) {
+        if (entries[i].vf_id == vf_id && entries[i].step == step &&
+            strcmp(entries[i].pf_name, pf_name) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Delay before the next attempt: exponential in the attempt count, with
+ * "equal jitter" (half fixed, half random) so VFs that failed together
+ * do not retry in lockstep
+ */
+static uint64_t backoff_ms(int attempts) {
+    uint64_t delay = RETRY_BASE_MS;
+
+    for (int i = 1; i < attempts && delay < RETRY_MAX_MS; i++) {
+        delay *= 2;
+    }
+    if (delay > RETRY_MAX_MS) {
+        delay = RETRY_MAX_MS;
+    }
+
+    if (seed == 0) {
+        seed = (unsigned int)monotonic_ms() ^ (unsigned int)getpid();
+    }
+    return delay / 2 + (uint64_t)rand_r(&seed) % (delay / 2 + 1);
+}
+
+/**
+ * Record a failed step and schedule its retry
+ */
+void retry_schedule(const pf_config_t *pf_config, int vf_id, config_step_t step) {
+    retry_entry_t *entry = find_entry(pf_config->name, vf_id, step);
+
+    if (!entry) {
+        if (entry_count >= entry_capacity) {
+            size_t capacity = entry_capacity ? entry_capacity * 2 : 16;
+            retry_entry_t *grown = realloc(entries, capacity * sizeof(retry_entry_t));
+            if (!grown) {
+                log_message(LOG_ERR, "Failed to allocate memory for retry state");
+                return;
+            }
+            entries = grown;
+            entry_capacity = capacity;
+        }
+        entry = &entries[entry_count++];
+        memset(entry, 0, sizeof(*entry));
+        strncpy(entry->pf_name, pf_config->name, MAX_NAME_LEN - 1);
+        entry->vf_id = vf_id;
+        entry->step = step;
+    }
+
+    if (!entry->pending) {
+        entry->attempts = 0;
+    }
+    entry->attempts++;
+    entry->failures++;
+
+    if (entry->attempts > RETRY_MAX_ATTEMPTS) {
+        entry->pending = 0;
+        log_message(LOG_ERR, "Giving up on %s for VF %d of %s after %d attempts",
+                   config_step_name(step), vf_id, pf_config->name, RETRY_MAX_ATTEMPTS);
+        /* The next reload re-applies this PF even if its config is unchanged */
+        reconcile_invalidate(pf_config->name);
+        return;
+    }
+
+    uint64_t delay = backoff_ms(entry->attempts);
+    entry->pending = 1;
+    entry->next_ms = monotonic_ms() + delay;
+    log_message(LOG_INFO, "Retrying %s for VF %d of %s in %llu ms (attempt %d)",
+               config_step_name(step), vf_id, pf_config->name,
+               (unsigned long long)delay, entry->attempts + 1);
+}
+
+/**
+ * Cancel pending retries for a PF whose VFs are being recreated
+ * Failure counters are kept; steps given up on get a fresh set of attempts.
+ */
+void retry_clear_pf(const char *pf_name) {
+    for (size_t i = 0; i < entry_count; i++) {
+        if (strcmp(entries[i].pf_name, pf_name) == 0) {
+            entries[i].pending = 0;
+            entries[i].attempts = 0;
+        }
+    }
+}
+
+/**
+ * Forget PFs that are no longer configured
+ */
+void retry_prune(const config_list_t *configs) {
+    size_t i = 0;
+    while (i < entry_count) {
+        int present = 0;
+        for (size_t j = 0; j < configs->count; j++) {
+            if (strcmp(configs->configs[j].name, entries[i].pf_name) == 0) {
+                present = 1;
+                break;
+            }
+        }
+        if (present) {
+            i++;
+        } else {
+            entries[i] = entries[--entry_count];
+        }
+    }
+}
+
+/**
+ * Check whether a VF still has a failed step awaiting retry
+ */
+int retry_pending(const char *pf_name, int vf_id) {
+    for (size_t i = 0; i < entry_count; i++) {
+        if (entries[i].pending && entries[i].vf_id == vf_id &&
+            strcmp(entries[i].pf_name, pf_name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Check whether one step of a VF still awaits a retry
+ */
+int retry_step_pending(const char *pf_name, int vf_id, config_step_t step) {
+    retry_entry_t *entry = find_entry(pf_name, vf_id, step);
+    return entry && entry->pending;
+}
+
+/**
+ * Check whether any step of a PF (or its VFs) still awaits a retry
+ */
+int retry_pending_pf(const char *pf_name) {
+    for (size_t i = 0; i < entry_count; i++) {
+        if (entries[i].pending && strcmp(entries[i].pf_name, pf_name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Check whether a step of a VF failed for good (retries exhausted)
+ */
+static int vf_given_up(const char *pf_name, int vf_id) {
+    for (size_t i = 0; i < entry_count; i++) {
+        if (!entries[i].pending && entries[i].attempts > RETRY_MAX_ATTEMPTS &&
+            entries[i].vf_id == vf_id && strcmp(entries[i].pf_name, pf_name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Milliseconds until the next retry is due
+ * Returns 0 if one is due now, -1 if nothing is scheduled
+ */
+long retry_next_delay_ms(void) {
+    uint64_t now = monotonic_ms();
+    long delay = -1;
+
+    for (size_t i = 0; i < entry_count; i++) {
+        if (!entries[i].pending) continue;
+        long until = entries[i].next_ms > now ? (long)(entries[i].next_ms - now) : 0;
+        if (delay < 0 || until < delay) {
+            delay = until;
+        }
+    }
+    return delay;
+}
+
+static pf_config_t *find_config(config_list_t *configs, const char *pf_name) {
+    for (size_t i = 0; i < configs->count; i++) {
+        if (strcmp(configs->configs[i].name, pf_name) == 0) {
+            return &configs->configs[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Make retries that waited for a step due now that it is done or given up
+ */
+static void wake_dependents(const char *pf_name, const vf_config_t *vf_config, config_step_t step) {
+    for (size_t i = 0; i < entry_count; i++) {
+        if (entries[i].pending && entries[i].vf_id == vf_config->id &&
+            config_step_prerequisite(vf_config, entries[i].step) == (int)step &&
+            strcmp(entries[i].pf_name, pf_name) == 0) {
+            entries[i].next_ms = 0;
+        }
+    }
+}
+
+/**
+ * Redo every due step against the active configuration generation
+ */
+void retry_run_due(config_list_t *configs) {
+    uint64_t now = monotonic_ms();
+    int changed = 0;
+
+    for (size_t i = 0; i < entry_count; i++) {
+        if (!entries[i].pending || entries[i].next_ms > now) continue;
+
+        /* Copy out: retry_schedule() may grow the table */
+        retry_entry_t entry = entries[i];
+        pf_config_t *pf_config = find_config(configs, entry.pf_name);
+        if (!pf_config || reconcile_cancelled(pf_config)) {
+            entries[i].pending = 0;
+            continue;
+        }
+
+        vf_config_t *vf_config = entry.vf_id >= 0 ? &pf_config->vfs[entry.vf_id] : NULL;
+
+        /* Wait for the prerequisite without using up an attempt */
+        int prerequisite = vf_config ? config_step_prerequisite(vf_config, entry.step) : -1;
+        retry_entry_t *blocker = prerequisite >= 0 ?
+            find_entry(pf_config->name, entry.vf_id, prerequisite) : NULL;
+        if (blocker && blocker->pending) {
+            entries[i].next_ms = blocker->next_ms + 1;
+            continue;
+        }
+
+        if (run_config_step(pf_config, vf_config, entry.step) == 0) {
+            entries[i].pending = 0;
+            log_message(LOG_INFO, "Retry of %s for VF %d of %s succeeded after %d attempt(s)",
+                       config_step_name(entry.step), entry.vf_id, pf_config->name,
+                       entry.attempts + 1);
+
+            /* Configured once nothing else is pending or was given up */
+            if (vf_config && !retry_pending(pf_config->name, entry.vf_id) &&
+                !vf_given_up(pf_config->name, entry.vf_id)) {
+                publish_vf(pf_config, vf_config, INVENTORY_STATE_CONFIGURED);
+            }
+        } else {
+            retry_schedule(pf_config, entry.vf_id, entry.step);
+            if (vf_config && !retry_step_pending(pf_config->name, entry.vf_id, entry.step)) {
+                publish_vf(pf_config, vf_config, INVENTORY_STATE_FAILED);
+            }
+        }
+        changed = 1;
+
+        if (vf_config && !retry_step_pending(pf_config->name, entry.vf_id, entry.step)) {
+            wake_dependents(pf_config->name, vf_config, entry.step);
+        }
+    }
+
+    if (changed) {
+        retry_export();
+    }
+}
+
+/**
+ * Write failure counters and pending retries in Prometheus text format
+ */
+void retry_export(void) {
+    char tmp_path[512];
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", RETRY_METRICS_PATH);
+    FILE *out = fopen(tmp_path, "w");
+    if (!out) {
+        log_message(LOG_ERR, "Cannot open %s: %s", tmp_path, strerror(errno));
+        return;
+    }
+
+    fprintf(out, "# TYPE viod_step_failures_total counter\n");
+    for (size_t i = 0; i < entry_count; i++) {
+        fprintf(out, "viod_step_failures_total{pf=\"%s\",vf=\"%d\",step=\"%s\"} %lu\n",
+                entries[i].pf_name, entries[i].vf_id, config_step_name(entries[i].step),
+                entries[i].failures);
+    }
+    fprintf(out, "# TYPE viod_step_retry_pending gauge\n");
+    for (size_t i = 0; i < entry_count; i++) {
+        fprintf(out, "viod_step_retry_pending{pf=\"%s\",vf=\"%d\",step=\"%s\"} %d\n",
+                entries[i].pf_name, entries[i].vf_id, config_step_name(entries[i].step),
+                entries[i].pending);
+    }
+    fclose(out);
+
+    if (rename(tmp_path, RETRY_METRICS_PATH) != 0) {
+        log_message(LOG_ERR, "Cannot replace %s: %s", RETRY_METRICS_PATH, strerror(errno));
+        unlink(tmp_path);
+    }
+}
+
+void retry_cleanup(void) {
+    free(entries);
+    entries = NULL;
+    entry_count = entry_capacity = 0;
+}
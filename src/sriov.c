@@ -5,6 +5,8 @@
  * Handles VF creation, configuration, driver binding, and network setup.
  */
 #include "viod.h"
+#include <spawn.h>
+#include <sys/wait.h>
 
 /**
  * Write a value to a sysfs file
@@ -30,27 +32,84 @@ static int write_sysfs_value(const char *path, const char *value) {
 
 /**
  * Apply all loaded configurations to create and configure VFs
+ * PFs whose configuration is unchanged since it was last applied are skipped,
+ * and PFs superseded by a newer submitted generation are left to that generation.
+ * Every PF to apply is validated before anything is changed on the host.
  * Returns 0 on success (some individual configs may fail with warnings)
  */
 int apply_all_configs(config_list_t *configs) {
     log_message(LOG_INFO, "Applying %zu configuration(s)", configs->count);
     
+    if (configs->count == 0) {
+        return 0;
+    }
+    
+    unsigned char *apply = calloc(configs->count, 1);
+    const pf_config_t **reserve = calloc(configs->count, sizeof(*reserve));
+    size_t reserve_count = 0;
+    if (!apply || !reserve) {
+        log_message(LOG_ERR, "Failed to allocate memory for configurations");
+        free(apply);
+        free(reserve);
+        return -1;
+    }
+    
     for (size_t i = 0; i < configs->count; i++) {
-        if (create_vfs(&configs->configs[i]) != 0) {
-            log_message(LOG_WARNING, "Failed to apply configuration %s", 
-                       configs->configs[i].config_file);
+        const pf_config_t *config = &configs->configs[i];
+        
+        if (!reconcile_needed(config)) {
+            log_message(LOG_DEBUG, "Configuration %s unchanged, skipping", config->config_file);
+            /* Its hugepages still count towards its node's pool */
+            reserve[reserve_count++] = config;
+            continue;
         }
+        if (reconcile_cancelled(config)) {
+            log_message(LOG_INFO, "Configuration %s superseded, skipping", config->config_file);
+            continue;
+        }
+        
+        /* Never tear down running VFs (or grow hugepage pools, which are
+         * never shrunk) for a configuration that cannot be applied */
+        int span = trace_begin("validate", "%s", config->name);
+        int valid = validate_pf_config(config);
+        trace_end(span);
+        if (valid != 0) {
+            log_message(LOG_WARNING, "Failed to apply configuration %s", config->config_file);
+            reconcile_done(config, -1);
+            continue;
+        }
+        apply[i] = 1;
+        reserve[reserve_count++] = config;
     }
     
+    /* Hugepages first, so DPDK tenants find them when their VFs appear */
+    reserve_hugepages(reserve, reserve_count);
+    
+    for (size_t i = 0; i < configs->count; i++) {
+        const pf_config_t *config = &configs->configs[i];
+        if (!apply[i]) continue;
+        
+        int span = trace_begin("pf", "%s", config->name);
+        int result = create_vfs(config);
+        trace_end(span);
+        if (result != 0) {
+            log_message(LOG_WARNING, "Failed to apply configuration %s", config->config_file);
+        }
+        reconcile_done(config, result);
+    }
+    
+    free(apply);
+    free(reserve);
     return 0;
 }
 
 /**
  * Create and configure Virtual Functions for a Physical Function
- * Handles VF creation, individual VF configuration, and promiscuous mode setup
+ * Handles VF creation, individual VF configuration, and promiscuous mode setup.
+ * The configuration must have passed validate_pf_config().
  * Returns 0 on success, -1 on critical failure
  */
-int create_vfs(pf_config_t *config) {
+int create_vfs(const pf_config_t *config) {
     char sysfs_path[512];
     char num_vfs_str[16];
     
@@ -61,41 +120,68 @@ int create_vfs(pf_config_t *config) {
             "/sys/bus/pci/devices/%s/sriov_numvfs", config->name);
     
     /* First, disable existing VFs */
+    int span = trace_begin("sriov_numvfs", "%s 0", config->name);
     if (write_sysfs_value(sysfs_path, "0") != 0) {
         log_message(LOG_WARNING, "Failed to disable existing VFs for %s", config->name);
     }
+    trace_end(span);
+    inventory_clear_pf(config->name);
+    retry_clear_pf(config->name);
     
     /* Wait a moment for cleanup */
+    span = trace_begin("wait", "%s teardown", config->name);
     usleep(100000); /* 100ms */
+    trace_end(span);
+    
+    /* The PF MTU caps the VFs, so change it before they are created */
+    if (config->kind == DEVICE_KIND_NET && config->mtu > 0) {
+        if (run_config_step(config, NULL, CONFIG_STEP_MTU) != 0) {
+            retry_schedule(config, -1, CONFIG_STEP_MTU);
+        }
+    }
+    
+    if (reconcile_cancelled(config)) {
+        log_message(LOG_INFO, "Creation of VFs for %s superseded", config->name);
+        return -1;
+    }
     
     /* Create new VFs */
     snprintf(num_vfs_str, sizeof(num_vfs_str), "%d", config->num_vfs);
-    if (write_sysfs_value(sysfs_path, num_vfs_str) != 0) {
+    span = trace_begin("sriov_numvfs", "%s %s", config->name, num_vfs_str);
+    int created = write_sysfs_value(sysfs_path, num_vfs_str);
+    trace_end(span);
+    if (created != 0) {
         log_message(LOG_ERR, "Failed to create VFs for %s", config->name);
         return -1;
     }
     
     /* Wait for VF creation */
+    span = trace_begin("wait", "%s vf creation", config->name);
     usleep(500000); /* 500ms */
+    trace_end(span);
     
     /* Configure each VF */
     for (int i = 0; i < config->num_vfs; i++) {
-        /* Ensure VF has a valid ID (in case it wasn't explicitly configured) */
-        if (config->vfs[i].id < 0) {
-            config->vfs[i].id = i;
+        /* Leave remaining VFs to a newer generation that changes this PF */
+        if (reconcile_cancelled(config)) {
+            log_message(LOG_INFO, "Configuration of %s superseded after %d VF(s)", config->name, i);
+            return -1;
         }
         
+        span = trace_begin("vf", "%s vf%d", config->name, i);
         if (configure_vf(config, &config->vfs[i]) != 0) {
             log_message(LOG_WARNING, "Failed to configure VF %d for %s", i, config->name);
         }
+        trace_end(span);
     }
     
     /* Enable promiscuous mode if requested (network devices only) */
     if (config->kind == DEVICE_KIND_NET && config->promisc) {
-        if (enable_promiscuous_mode(config->name) != 0) {
-            log_message(LOG_WARNING, "Failed to enable promiscuous mode on %s", config->name);
+        if (run_config_step(config, NULL, CONFIG_STEP_PROMISC) != 0) {
+            retry_schedule(config, -1, CONFIG_STEP_PROMISC);
         }
     }
+    retry_export();
     
     log_message(LOG_INFO, "Successfully created and configured %d VFs for %s", 
                config->num_vfs, config->name);
@@ -185,172 +271,352 @@ int get_vf_pci_address(const char *pf_name, int vf_id, char *vf_pci_addr, size_t
     return 0;
 }
 
-int configure_vf(pf_config_t *pf_config, vf_config_t *vf_config) {
-    if (vf_config->id < 0) {
-        return 0; // Skip unconfigured VFs
-    }
-    
-    log_message(LOG_INFO, "Configuring VF %d for PF %s", vf_config->id, pf_config->name);
+/**
+ * Find the network interface name of a PCI device
+ * Looks up the first netdev listed under /sys/bus/pci/devices/<addr>/net
+ * Returns 0 on success, -1 if the device has no netdev
+ */
+int get_pci_interface(const char *pci_addr, char *interface_name, size_t name_size) {
+    char net_path[512];
+    char pci_full[64];
+    DIR *net_dir;
+    struct dirent *entry;
     
-    // Set MAC address (network devices only)
-    if (pf_config->kind == DEVICE_KIND_NET) {
-        char mac_to_set[18];
-        
-        if (strlen(vf_config->mac) > 0) {
-            // Use configured MAC
-            strncpy(mac_to_set, vf_config->mac, sizeof(mac_to_set) - 1);
-            mac_to_set[sizeof(mac_to_set) - 1] = '\0';
-        } else {
-            // Generate stable MAC address
-            generate_stable_mac(pf_config->name, vf_config->id, mac_to_set);
-            log_message(LOG_INFO, "Generated stable MAC %s for VF %d", mac_to_set, vf_config->id);
-        }
-        
-        if (set_vf_mac(pf_config->name, vf_config->id, mac_to_set) != 0) {
-            log_message(LOG_WARNING, "Failed to set MAC for VF %d", vf_config->id);
-        }
+    if (normalize_pci_address(pci_addr, pci_full, sizeof(pci_full)) != 0) {
+        return -1;
     }
     
-    // Set VLAN (network devices only)
-    if (pf_config->kind == DEVICE_KIND_NET && vf_config->vlan > 0) {
-        if (set_vf_vlan(pf_config->name, vf_config->id, vf_config->vlan) != 0) {
-            log_message(LOG_WARNING, "Failed to set VLAN for VF %d", vf_config->id);
-        }
+    interface_name[0] = '\0';
+    snprintf(net_path, sizeof(net_path), "/sys/bus/pci/devices/%s/net", pci_full);
+    net_dir = opendir(net_path);
+    if (!net_dir) {
+        return -1;
     }
     
-    // Bind driver if specified
-    if (strlen(vf_config->driver) > 0) {
-        char vf_pci_addr[64];
-        
-        if (get_vf_pci_address(pf_config->name, vf_config->id, vf_pci_addr, sizeof(vf_pci_addr)) == 0) {
-            if (bind_vf_driver(vf_pci_addr, vf_config->driver) != 0) {
-                log_message(LOG_WARNING, "Failed to bind driver %s for VF %d (%s)", 
-                           vf_config->driver, vf_config->id, vf_pci_addr);
-            }
-        } else {
-            log_message(LOG_WARNING, "Cannot get PCI address for VF %d, skipping driver binding", 
-                       vf_config->id);
+    while ((entry = readdir(net_dir)) != NULL) {
+        if (entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            strncpy(interface_name, entry->d_name, name_size - 1);
+            interface_name[name_size - 1] = '\0';
+            break;
         }
     }
+    closedir(net_dir);
     
-    return 0;
+    return strlen(interface_name) > 0 ? 0 : -1;
 }
 
-int enable_promiscuous_mode(const char *pci_addr) {
-    char net_path[512];
-    char interface_name[256] = "";
-    DIR *net_dir;
-    struct dirent *entry;
-    
-    // Find network interface name from PCI address
-    snprintf(net_path, sizeof(net_path), "/sys/bus/pci/devices/%s/net", pci_addr);
-    net_dir = opendir(net_path);
-    
-    if (net_dir) {
-        while ((entry = readdir(net_dir)) != NULL) {
-            if (entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
-                strncpy(interface_name, entry->d_name, sizeof(interface_name) - 1);
-                break;
-            }
-        }
-        closedir(net_dir);
+/**
+ * Get the MAC address to apply to a VF
+ * Uses the configured or indexed MAC (see mac_index_build()), or a stable
+ * generated one if none is set
+ */
+void resolve_vf_mac(const pf_config_t *pf_config, const vf_config_t *vf_config, char *mac) {
+    if (strlen(vf_config->mac) > 0) {
+        strncpy(mac, vf_config->mac, 17);
+        mac[17] = '\0';
+    } else {
+        generate_stable_mac(pf_config->name, vf_config->id, NULL, 0, mac);
     }
+}
+
+/**
+ * Publish a VF's state in the inventory
+ * Only network VFs carry a MAC, so MAC lookups never match GPU or generic VFs.
+ */
+void publish_vf(const pf_config_t *pf_config, const vf_config_t *vf_config, inventory_state_t state) {
+    char mac[18] = "";
     
-    if (strlen(interface_name) == 0) {
-        log_message(LOG_ERR, "Cannot find network interface for PCI device %s", pci_addr);
-        return -1;
+    if (pf_config->kind == DEVICE_KIND_NET) {
+        resolve_vf_mac(pf_config, vf_config, mac);
     }
-    
-    char command[512];
-    snprintf(command, sizeof(command), "ip link set %s promisc on", interface_name);
-    
-    int result = system(command);
-    if (result != 0) {
-        log_message(LOG_ERR, "Failed to enable promiscuous mode on %s (%s)", interface_name, pci_addr);
-        return -1;
+    inventory_update_vf(pf_config, vf_config, mac, state);
+}
+
+/**
+ * Get a short name for a configuration step (used in logs, traces and metrics)
+ */
+const char *config_step_name(config_step_t step) {
+    switch (step) {
+        case CONFIG_STEP_MAC:        return "mac";
+        case CONFIG_STEP_VLAN:       return "vlan";
+        case CONFIG_STEP_LINK_STATE: return "link_state";
+        case CONFIG_STEP_TRUST:      return "trust";
+        case CONFIG_STEP_SPOOFCHK:   return "spoofchk";
+        case CONFIG_STEP_QUERY_RSS:  return "query_rss";
+        case CONFIG_STEP_GPU_PROFILE: return "gpu_profile";
+        case CONFIG_STEP_BIND:       return "bind";
+        case CONFIG_STEP_MTU:        return "mtu";
+        case CONFIG_STEP_NETNS:      return "netns";
+        case CONFIG_STEP_PROMISC:    return "promisc";
+        default:                     return "unknown";
     }
-    
-    log_message(LOG_INFO, "Enabled promiscuous mode on %s (%s)", interface_name, pci_addr);
-    return 0;
 }
 
-int set_vf_mac(const char *pf_pci_addr, int vf_id, const char *mac) {
-    char net_path[512];
-    char interface_name[256] = "";
-    DIR *net_dir;
-    struct dirent *entry;
-    
-    // Find network interface name from PCI address
-    snprintf(net_path, sizeof(net_path), "/sys/bus/pci/devices/%s/net", pf_pci_addr);
-    net_dir = opendir(net_path);
-    
-    if (net_dir) {
-        while ((entry = readdir(net_dir)) != NULL) {
-            if (entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
-                strncpy(interface_name, entry->d_name, sizeof(interface_name) - 1);
-                break;
-            }
-        }
-        closedir(net_dir);
+/**
+ * Check whether a VF configuration step applies to this VF
+ */
+static int config_step_needed(const pf_config_t *pf_config, const vf_config_t *vf_config,
+                              config_step_t step) {
+    switch (step) {
+        case CONFIG_STEP_MAC:
+            return pf_config->kind == DEVICE_KIND_NET;
+        case CONFIG_STEP_VLAN:
+            return pf_config->kind == DEVICE_KIND_NET && (vf_config->vlan > 0 || vf_config->vlan_qos > 0);
+        case CONFIG_STEP_LINK_STATE:
+            return pf_config->kind == DEVICE_KIND_NET && vf_config->link_state != VF_LINK_STATE_UNSET;
+        case CONFIG_STEP_TRUST:
+            return pf_config->kind == DEVICE_KIND_NET && vf_config->trust != VF_FLAG_UNSET;
+        case CONFIG_STEP_SPOOFCHK:
+            return pf_config->kind == DEVICE_KIND_NET && vf_config->spoofchk != VF_FLAG_UNSET;
+        case CONFIG_STEP_QUERY_RSS:
+            return pf_config->kind == DEVICE_KIND_NET && vf_config->query_rss != VF_FLAG_UNSET;
+        case CONFIG_STEP_GPU_PROFILE:
+            return pf_config->kind == DEVICE_KIND_GPU && gpu_profile_set(&vf_config->gpu);
+        case CONFIG_STEP_BIND:
+            return strlen(vf_config->driver) > 0;
+        case CONFIG_STEP_MTU:
+            return pf_config->kind == DEVICE_KIND_NET && vf_config->mtu > 0;
+        case CONFIG_STEP_NETNS:
+            return pf_config->kind == DEVICE_KIND_NET && (vf_config->netns[0] || vf_config->ifname[0]);
+        default:
+            return 0;
     }
-    
-    if (strlen(interface_name) == 0) {
-        log_message(LOG_ERR, "Cannot find network interface for PCI device %s", pf_pci_addr);
+}
+
+/**
+ * Get the VF step that must be done (or given up) before another may run
+ *   - GPU resources are fixed once the VF driver has probed, so bind waits
+ *     for the profile
+ *   - netdev steps find the VF netdev through its PCI sysfs entry, which
+ *     follows a rename in our namespace but not a move out of it, so a move
+ *     waits for the MTU
+ * Returns the step, or -1 if the step waits for nothing
+ */
+int config_step_prerequisite(const vf_config_t *vf_config, config_step_t step) {
+    switch (step) {
+        case CONFIG_STEP_BIND:
+            return CONFIG_STEP_GPU_PROFILE;
+        case CONFIG_STEP_NETNS:
+            return vf_config->netns[0] ? CONFIG_STEP_MTU : -1;
+        default:
+            return -1;
+    }
+}
+
+/**
+ * Run a single configuration step
+ * vf_config is NULL for PF-level steps. Used for the initial pass and for retries.
+ * Returns 0 on success, -1 on failure
+ */
+int run_config_step(const pf_config_t *pf_config, const vf_config_t *vf_config, config_step_t step) {
+    int result = -1;
+    int span;
+    
+    int prerequisite = vf_config ? config_step_prerequisite(vf_config, step) : -1;
+    if (prerequisite >= 0 && retry_step_pending(pf_config->name, vf_config->id, prerequisite)) {
+        log_message(LOG_INFO, "Deferring %s of VF %d until its %s retry is done",
+                   config_step_name(step), vf_config->id, config_step_name(prerequisite));
         return -1;
     }
     
-    char command[512];
-    snprintf(command, sizeof(command), "ip link set %s vf %d mac %s", 
-             interface_name, vf_id, mac);
-    
-    int result = system(command);
-    if (result != 0) {
-        log_message(LOG_ERR, "Failed to set MAC %s for VF %d on %s (%s)", 
-                   mac, vf_id, interface_name, pf_pci_addr);
-        return -1;
+    switch (step) {
+        case CONFIG_STEP_MAC: {
+            char mac_to_set[18];
+            resolve_vf_mac(pf_config, vf_config, mac_to_set);
+            if (vf_config->mac_generated) {
+                log_message(LOG_INFO, "Generated stable MAC %s for VF %d", mac_to_set, vf_config->id);
+            }
+            
+            span = trace_begin("set_vf_mac", "%s vf%d %s", pf_config->name, vf_config->id, mac_to_set);
+            result = set_vf_mac(pf_config->name, vf_config->id, mac_to_set);
+            trace_end(span);
+            if (result != 0) {
+                log_message(LOG_WARNING, "Failed to set MAC for VF %d", vf_config->id);
+            }
+            break;
+        }
+        
+        case CONFIG_STEP_VLAN:
+            span = trace_begin("set_vf_vlan", "%s vf%d %d qos %d", pf_config->name, vf_config->id,
+                               vf_config->vlan, vf_config->vlan_qos);
+            result = set_vf_vlan(pf_config->name, vf_config->id, vf_config->vlan,
+                                 vf_config->vlan_qos, vf_config->vlan_proto);
+            trace_end(span);
+            if (result != 0) {
+                log_message(LOG_WARNING, "Failed to set VLAN for VF %d", vf_config->id);
+            }
+            break;
+        
+        case CONFIG_STEP_LINK_STATE:
+            span = trace_begin("set_vf_link_state", "%s vf%d %s", pf_config->name, vf_config->id,
+                               vf_link_state_name(vf_config->link_state));
+            result = set_vf_link_state(pf_config->name, vf_config->id, vf_config->link_state);
+            trace_end(span);
+            if (result != 0) {
+                log_message(LOG_WARNING, "Failed to set link state for VF %d", vf_config->id);
+            }
+            break;
+        
+        case CONFIG_STEP_TRUST:
+        case CONFIG_STEP_SPOOFCHK:
+        case CONFIG_STEP_QUERY_RSS: {
+            int attr = step == CONFIG_STEP_TRUST ? IFLA_VF_TRUST :
+                       step == CONFIG_STEP_SPOOFCHK ? IFLA_VF_SPOOFCHK : IFLA_VF_RSS_QUERY_EN;
+            vf_flag_t flag = step == CONFIG_STEP_TRUST ? vf_config->trust :
+                             step == CONFIG_STEP_SPOOFCHK ? vf_config->spoofchk : vf_config->query_rss;
+            
+            span = trace_begin(config_step_name(step), "%s vf%d %s", pf_config->name, vf_config->id,
+                               vf_flag_name(flag));
+            result = set_vf_flag(pf_config->name, vf_config->id, attr, flag);
+            trace_end(span);
+            if (result != 0) {
+                log_message(LOG_WARNING, "Failed to set %s for VF %d", config_step_name(step), vf_config->id);
+            }
+            break;
+        }
+        
+        case CONFIG_STEP_GPU_PROFILE:
+            span = trace_begin("gpu_profile", "%s vf%d %s", pf_config->name, vf_config->id,
+                               vf_config->gpu.name);
+            result = apply_gpu_profile(pf_config->name, vf_config->id, &vf_config->gpu);
+            trace_end(span);
+            if (result != 0) {
+                log_message(LOG_WARNING, "Failed to provision GPU resources for VF %d", vf_config->id);
+            }
+            break;
+        
+        case CONFIG_STEP_BIND: {
+            char vf_pci_addr[64];
+            
+            span = trace_begin("get_vf_pci_address", "%s vf%d", pf_config->name, vf_config->id);
+            int found = get_vf_pci_address(pf_config->name, vf_config->id, vf_pci_addr, sizeof(vf_pci_addr));
+            trace_end(span);
+            
+            if (found != 0) {
+                log_message(LOG_WARNING, "Cannot get PCI address for VF %d, skipping driver binding", 
+                           vf_config->id);
+                break;
+            }
+            
+            span = trace_begin("bind_vf_driver", "%s %s", vf_pci_addr, vf_config->driver);
+            result = bind_vf_driver(vf_pci_addr, vf_config->driver);
+            trace_end(span);
+            if (result != 0) {
+                log_message(LOG_WARNING, "Failed to bind driver %s for VF %d (%s)", 
+                           vf_config->driver, vf_config->id, vf_pci_addr);
+            } else if (strcmp(vf_config->driver, "vfio-pci") == 0) {
+                /* Other devices in the group may be rebound later, so this is retried */
+                result = vfio_group_viable(vf_pci_addr);
+            }
+            break;
+        }
+        
+        case CONFIG_STEP_MTU: {
+            char pci_addr[64];
+            int mtu = vf_config ? vf_config->mtu : pf_config->mtu;
+            
+            /* VF MTU is set on the VF's own netdev, which exists once it is bound */
+            if (!vf_config) {
+                strncpy(pci_addr, pf_config->name, sizeof(pci_addr) - 1);
+                pci_addr[sizeof(pci_addr) - 1] = '\0';
+            } else if (get_vf_pci_address(pf_config->name, vf_config->id, pci_addr, sizeof(pci_addr)) != 0) {
+                log_message(LOG_WARNING, "Cannot get PCI address for VF %d, skipping MTU", vf_config->id);
+                break;
+            }
+            
+            span = trace_begin("set_mtu", "%s %d", pci_addr, mtu);
+            result = set_pci_mtu(pci_addr, mtu);
+            trace_end(span);
+            if (result != 0) {
+                log_message(LOG_WARNING, "Failed to set MTU %d on %s", mtu, pci_addr);
+            }
+            break;
+        }
+        
+        case CONFIG_STEP_NETNS: {
+            char vf_pci_addr[64];
+            
+            if (get_vf_pci_address(pf_config->name, vf_config->id, vf_pci_addr, sizeof(vf_pci_addr)) != 0) {
+                log_message(LOG_WARNING, "Cannot get PCI address for VF %d, skipping netns", vf_config->id);
+                break;
+            }
+            
+            span = trace_begin("netns", "%s %s %s", vf_pci_addr, vf_config->netns, vf_config->ifname);
+            result = move_pci_netdev(vf_pci_addr, vf_config->netns, vf_config->ifname);
+            trace_end(span);
+            if (result != 0) {
+                log_message(LOG_WARNING, "Failed to move netdev of VF %d", vf_config->id);
+            }
+            break;
+        }
+        
+        case CONFIG_STEP_PROMISC:
+            span = trace_begin("promisc", "%s", pf_config->name);
+            result = enable_promiscuous_mode(pf_config->name);
+            trace_end(span);
+            if (result != 0) {
+                log_message(LOG_WARNING, "Failed to enable promiscuous mode on %s", pf_config->name);
+            }
+            break;
     }
     
-    log_message(LOG_INFO, "Set MAC %s for VF %d on %s (%s)", mac, vf_id, interface_name, pf_pci_addr);
-    return 0;
+    return result;
 }
 
-int set_vf_vlan(const char *pf_pci_addr, int vf_id, int vlan) {
-    char net_path[512];
-    char interface_name[256] = "";
-    DIR *net_dir;
-    struct dirent *entry;
+int configure_vf(const pf_config_t *pf_config, const vf_config_t *vf_config) {
+    static const config_step_t vf_steps[] = {
+        CONFIG_STEP_MAC, CONFIG_STEP_VLAN, CONFIG_STEP_LINK_STATE, CONFIG_STEP_TRUST,
+        CONFIG_STEP_SPOOFCHK, CONFIG_STEP_QUERY_RSS, CONFIG_STEP_GPU_PROFILE, CONFIG_STEP_BIND,
+        CONFIG_STEP_MTU, CONFIG_STEP_NETNS
+    };
+    int failed = 0;
     
-    // Find network interface name from PCI address
-    snprintf(net_path, sizeof(net_path), "/sys/bus/pci/devices/%s/net", pf_pci_addr);
-    net_dir = opendir(net_path);
+    if (vf_config->id < 0) {
+        return 0; // Skip unconfigured VFs
+    }
     
-    if (net_dir) {
-        while ((entry = readdir(net_dir)) != NULL) {
-            if (entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
-                strncpy(interface_name, entry->d_name, sizeof(interface_name) - 1);
-                break;
-            }
+    log_message(LOG_INFO, "Configuring VF %d for PF %s", vf_config->id, pf_config->name);
+    
+    // MAC, VLAN, flags and GPU resources before binding so the VF driver starts
+    // with them, MTU after binding since it is set on the VF netdev, and the
+    // netdev is moved to its namespace last once nothing else needs it in ours
+    for (size_t i = 0; i < sizeof(vf_steps) / sizeof(vf_steps[0]); i++) {
+        if (!config_step_needed(pf_config, vf_config, vf_steps[i])) {
+            continue;
+        }
+        if (run_config_step(pf_config, vf_config, vf_steps[i]) != 0) {
+            // Retry just this step later instead of waiting for a full reload
+            retry_schedule(pf_config, vf_config->id, vf_steps[i]);
+            failed = 1;
         }
-        closedir(net_dir);
     }
     
-    if (strlen(interface_name) == 0) {
-        log_message(LOG_ERR, "Cannot find network interface for PCI device %s", pf_pci_addr);
+    // Publish the applied state for local consumers
+    publish_vf(pf_config, vf_config, failed ? INVENTORY_STATE_FAILED : INVENTORY_STATE_CONFIGURED);
+    
+    return failed ? -1 : 0;
+}
+
+/**
+ * Load a kernel module with modprobe, run directly (no shell)
+ * modprobe returns once the module is initialized and its drivers registered.
+ * Returns 0 on success, -1 on failure
+ */
+static int load_module(const char *module) {
+    char *const argv[] = { "modprobe", "-q", (char *)module, NULL };
+    pid_t pid;
+    int status;
+    
+    int err = posix_spawnp(&pid, "modprobe", NULL, NULL, argv, environ);
+    if (err != 0) {
+        log_message(LOG_ERR, "Cannot run modprobe %s: %s", module, strerror(err));
         return -1;
     }
-    
-    char command[512];
-    snprintf(command, sizeof(command), "ip link set %s vf %d vlan %d", 
-             interface_name, vf_id, vlan);
-    
-    int result = system(command);
-    if (result != 0) {
-        log_message(LOG_ERR, "Failed to set VLAN %d for VF %d on %s (%s)", 
-                   vlan, vf_id, interface_name, pf_pci_addr);
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        log_message(LOG_ERR, "modprobe %s failed", module);
         return -1;
     }
-    
-    log_message(LOG_INFO, "Set VLAN %d for VF %d on %s (%s)", vlan, vf_id, interface_name, pf_pci_addr);
     return 0;
 }
 
@@ -365,8 +631,9 @@ int bind_vf_driver(const char *pci_addr, const char *driver) {
         snprintf(driver_path, sizeof(driver_path), "/sys/bus/pci/drivers/%s", driver);
         if (access(driver_path, F_OK) != 0) {
             log_message(LOG_INFO, "Loading vfio-pci module");
-            system("modprobe vfio-pci");
-            usleep(500000); // Wait for module to load
+            int span = trace_begin("modprobe", "vfio-pci");
+            load_module("vfio-pci");
+            trace_end(span);
         }
     }
     
@@ -407,10 +674,12 @@ int bind_vf_driver(const char *pci_addr, const char *driver) {
             snprintf(unbind_path, sizeof(unbind_path), 
                     "/sys/bus/pci/drivers/%s/unbind", driver_name);
             log_message(LOG_INFO, "Unbinding %s from driver %s", pci_addr, driver_name);
+            int span = trace_begin("unbind", "%s %s", pci_addr, driver_name);
             write_sysfs_value(unbind_path, pci_addr);
             
             // Small delay to ensure unbind completes
             usleep(200000); // 200ms
+            trace_end(span);
         }
     }
     
@@ -443,8 +712,10 @@ int bind_vf_driver(const char *pci_addr, const char *driver) {
                         "/sys/bus/pci/drivers/vfio-pci/new_id");
                 
                 log_message(LOG_INFO, "Adding device ID %s to vfio-pci", vendor_device);
+                int span = trace_begin("new_id", "%s %s", pci_addr, vendor_device);
                 write_sysfs_value(new_id_path, vendor_device);
                 usleep(100000); // 100ms
+                trace_end(span);
             }
         }
         
@@ -456,7 +727,10 @@ int bind_vf_driver(const char *pci_addr, const char *driver) {
     snprintf(bind_path, sizeof(bind_path), 
             "/sys/bus/pci/drivers/%s/bind", driver);
     
-    if (write_sysfs_value(bind_path, pci_addr) != 0) {
+    int span = trace_begin("bind", "%s %s", pci_addr, driver);
+    int bound = write_sysfs_value(bind_path, pci_addr);
+    trace_end(span);
+    if (bound != 0) {
         log_message(LOG_ERR, "Failed to bind %s to driver %s", pci_addr, driver);
         return -1;
     }
@@ -464,27 +738,3 @@ int bind_vf_driver(const char *pci_addr, const char *driver) {
     log_message(LOG_INFO, "Successfully bound %s to driver %s", pci_addr, driver);
     return 0;
 }
-
-/**
- * Generate a stable, deterministic MAC address for a VF
- * Uses SHA256 hash of PCI address, VF ID, and salt to ensure:
- * - Consistent MAC across reboots
- * - Unique MACs per PF/VF combination
- * - Locally administered format (02:xx:xx:xx:xx:xx) to avoid conflicts
- */
-void generate_stable_mac(const char *pf_pci_addr, int vf_id, char *mac_addr) {
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    char input[512];
-    
-    /* Create deterministic input string: PCI address + VF ID + "viod" */
-    snprintf(input, sizeof(input), "%s-%d-viod", pf_pci_addr, vf_id);
-    
-    /* Generate SHA256 hash */
-    SHA256((unsigned char *)input, strlen(input), hash);
-    
-    /* Create MAC address with locally administered bit set (02:xx:xx:xx:xx:xx)
-     * This ensures it won't conflict with real hardware MACs
-     * Use the first 5 bytes of the hash for the last 5 octets */
-    snprintf(mac_addr, 18, "02:%02x:%02x:%02x:%02x:%02x",
-             hash[0], hash[1], hash[2], hash[3], hash[4]);
-}
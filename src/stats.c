@@ -0,0 +1,216 @@
+/**
+ * viod - SR-IOV Virtual Function daemon
+ *
+ * VF traffic statistics implementation
+ * Collects IFLA_VF_STATS for every managed PF with a single RTM_GETLINK dump
+ * per interval and exports them in Prometheus text format to METRICS_PATH
+ * (suitable for the node_exporter textfile collector).
+ */
+#include "viod.h"
+#include <net/if.h>
+
+/* A managed PF whose VF counters are exported */
+typedef struct {
+    char pci_addr[64];              /**< PF PCI address (full format) */
+    int ifindex;                    /**< PF netdev ifindex, 0 until resolved */
+    int seen;                       /**< Found in the current dump */
+} stats_target_t;
+
+/* State shared with the dump callback */
+typedef struct {
+    FILE *out;
+    size_t vfs;
+} stats_ctx_t;
+
+/* Counter name and attribute for each exported VF statistic */
+static const struct {
+    int attr;
+    const char *name;
+} vf_counters[] = {
+    { IFLA_VF_STATS_RX_PACKETS, "rx_packets" },
+    { IFLA_VF_STATS_TX_PACKETS, "tx_packets" },
+    { IFLA_VF_STATS_RX_BYTES,   "rx_bytes" },
+    { IFLA_VF_STATS_TX_BYTES,   "tx_bytes" },
+    { IFLA_VF_STATS_BROADCAST,  "broadcast" },
+    { IFLA_VF_STATS_MULTICAST,  "multicast" },
+    { IFLA_VF_STATS_RX_DROPPED, "rx_dropped" },
+    { IFLA_VF_STATS_TX_DROPPED, "tx_dropped" },
+};
+
+static int stats_fd = -1;
+static stats_target_t *targets = NULL;
+static size_t target_count = 0;
+
+/**
+ * Open the netlink socket used for statistics dumps
+ * Returns 0 on success, -1 on failure
+ */
+int stats_open(void) {
+    stats_fd = nl_open(NETLINK_ROUTE);
+    return stats_fd < 0 ? -1 : 0;
+}
+
+void stats_close(void) {
+    if (stats_fd >= 0) {
+        close(stats_fd);
+        stats_fd = -1;
+    }
+    free(targets);
+    targets = NULL;
+    target_count = 0;
+}
+
+/**
+ * Replace the set of PFs whose VF counters are exported
+ * Only network PFs are tracked; ifindexes are resolved lazily on collection.
+ * Returns the number of tracked PFs
+ */
+size_t stats_set_targets(const config_list_t *configs) {
+    free(targets);
+    targets = NULL;
+    target_count = 0;
+
+    if (configs->count == 0) {
+        return 0;
+    }
+
+    targets = calloc(configs->count, sizeof(stats_target_t));
+    if (!targets) {
+        log_message(LOG_ERR, "Failed to allocate memory for statistics targets");
+        return 0;
+    }
+
+    for (size_t i = 0; i < configs->count; i++) {
+        const pf_config_t *config = &configs->configs[i];
+        if (config->kind != DEVICE_KIND_NET) continue;
+        if (normalize_pci_address(config->name, targets[target_count].pci_addr,
+                                  sizeof(targets[target_count].pci_addr)) == 0) {
+            target_count++;
+        }
+    }
+    return target_count;
+}
+
+static stats_target_t *find_target(int ifindex) {
+    for (size_t i = 0; i < target_count; i++) {
+        if (targets[i].ifindex == ifindex) {
+            return &targets[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Dump callback: export the VF counters of one link if it is a managed PF
+ */
+static void stats_link_cb(struct nlmsghdr *nlh, void *arg) {
+    stats_ctx_t *ctx = arg;
+    struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    struct rtattr *tb[IFLA_MAX + 1];
+
+    if (nlh->nlmsg_type != RTM_NEWLINK) return;
+
+    stats_target_t *target = find_target(ifi->ifi_index);
+    if (!target) return;
+    target->seen = 1;
+
+    nl_parse_attrs(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(nlh));
+    if (!tb[IFLA_VFINFO_LIST]) return;
+
+    const char *ifname = tb[IFLA_IFNAME] ? RTA_DATA(tb[IFLA_IFNAME]) : "";
+
+    struct rtattr *vf_info = RTA_DATA(tb[IFLA_VFINFO_LIST]);
+    int rem = RTA_PAYLOAD(tb[IFLA_VFINFO_LIST]);
+    for (; RTA_OK(vf_info, rem); vf_info = RTA_NEXT(vf_info, rem)) {
+        struct rtattr *vf[IFLA_VF_MAX + 1];
+        struct rtattr *st[IFLA_VF_STATS_MAX + 1];
+
+        nl_parse_attrs(vf, IFLA_VF_MAX, RTA_DATA(vf_info), RTA_PAYLOAD(vf_info));
+        if (!vf[IFLA_VF_MAC] || !vf[IFLA_VF_STATS]) continue;
+
+        const struct ifla_vf_mac *mac = RTA_DATA(vf[IFLA_VF_MAC]);
+        nl_parse_attrs(st, IFLA_VF_STATS_MAX, RTA_DATA(vf[IFLA_VF_STATS]),
+                       RTA_PAYLOAD(vf[IFLA_VF_STATS]));
+
+        for (size_t i = 0; i < sizeof(vf_counters) / sizeof(vf_counters[0]); i++) {
+            struct rtattr *counter = st[vf_counters[i].attr];
+            if (!counter || RTA_PAYLOAD(counter) < sizeof(uint64_t)) continue;
+
+            uint64_t value;
+            memcpy(&value, RTA_DATA(counter), sizeof(value));
+            fprintf(ctx->out, "viod_vf_%s_total{pf=\"%s\",ifname=\"%s\",vf=\"%u\"} %llu\n",
+                    vf_counters[i].name, target->pci_addr, ifname, mac->vf,
+                    (unsigned long long)value);
+        }
+        ctx->vfs++;
+    }
+}
+
+/**
+ * Collect VF counters for all managed PFs and rewrite the metrics file
+ * Uses one RTM_GETLINK dump; the file is replaced atomically.
+ * Returns 0 on success, -1 on failure
+ */
+int stats_collect(void) {
+    char buf[256];
+    char tmp_path[512];
+    stats_ctx_t ctx = {0};
+
+    if (stats_fd < 0) {
+        return -1;
+    }
+
+    /* Resolve PFs whose netdev was missing or has been re-registered */
+    for (size_t i = 0; i < target_count; i++) {
+        if (targets[i].ifindex <= 0) {
+            targets[i].ifindex = get_pci_ifindex(targets[i].pci_addr);
+        }
+        targets[i].seen = 0;
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", METRICS_PATH);
+    ctx.out = fopen(tmp_path, "w");
+    if (!ctx.out) {
+        log_message(LOG_ERR, "Cannot open %s: %s", tmp_path, strerror(errno));
+        return -1;
+    }
+
+    for (size_t i = 0; i < sizeof(vf_counters) / sizeof(vf_counters[0]); i++) {
+        fprintf(ctx.out, "# TYPE viod_vf_%s_total counter\n", vf_counters[i].name);
+    }
+
+    struct nlmsghdr *nlh = nl_msg_init(buf, sizeof(buf), RTM_GETLINK, NLM_F_REQUEST,
+                                       sizeof(struct ifinfomsg));
+    struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    ifi->ifi_family = AF_UNSPEC;
+    nl_attr_put_u32(nlh, sizeof(buf), IFLA_EXT_MASK, RTEXT_FILTER_VF);
+
+    int result = nl_dump(stats_fd, nlh, stats_link_cb, &ctx);
+    fclose(ctx.out);
+
+    if (result != 0) {
+        log_message(LOG_WARNING, "Failed to dump VF statistics: %s", strerror(-result));
+        unlink(tmp_path);
+        /* Force re-resolution in case a PF netdev went away */
+        for (size_t i = 0; i < target_count; i++) {
+            targets[i].ifindex = 0;
+        }
+        return -1;
+    }
+
+    /* PFs missing from the dump are re-resolved next time */
+    for (size_t i = 0; i < target_count; i++) {
+        if (!targets[i].seen) {
+            targets[i].ifindex = 0;
+        }
+    }
+
+    if (rename(tmp_path, METRICS_PATH) != 0) {
+        log_message(LOG_ERR, "Cannot replace %s: %s", METRICS_PATH, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+
+    log_message(LOG_DEBUG, "Exported statistics for %zu VF(s)", ctx.vfs);
+    return 0;
+}
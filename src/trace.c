@@ -0,0 +1,189 @@
+/**
+ * viod - SR-IOV Virtual Function daemon
+ *
+ * Reconcile timeline tracing implementation
+ * When VIOD_TRACE_DIR is set, begin/end spans of PF and VF operations are
+ * recorded with thread IDs into a preallocated buffer and written out after
+ * every reconcile as a Chrome trace JSON file, viewable in Perfetto or
+ * chrome://tracing.
+ */
+#include "viod.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <sys/syscall.h>
+
+#define TRACE_MAX_SPANS 65536
+#define TRACE_DETAIL_LEN 96
+
+/* One recorded span */
+typedef struct {
+    const char *name;               /**< Operation name (static string) */
+    char detail[TRACE_DETAIL_LEN];  /**< PF/VF/driver the operation applies to */
+    uint64_t start_us;              /**< Monotonic start time */
+    uint64_t dur_us;                /**< Duration, 0 while still open */
+    pid_t tid;                      /**< Thread that recorded the span */
+} trace_span_t;
+
+static trace_span_t *spans = NULL;
+static unsigned int span_count = 0;
+static unsigned int dropped = 0;
+static unsigned int epoch = 0;      /* Bumped on flush; stale handles are ignored */
+static char trace_dir[512];
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * Enable tracing if VIOD_TRACE_DIR is set
+ * Returns 0 on success (including tracing disabled), -1 on failure
+ */
+int trace_init(void) {
+    const char *dir = getenv("VIOD_TRACE_DIR");
+    if (!dir || !*dir) {
+        return 0;
+    }
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        log_message(LOG_ERR, "Failed to create trace directory %s: %s", dir, strerror(errno));
+        return -1;
+    }
+
+    spans = calloc(TRACE_MAX_SPANS, sizeof(trace_span_t));
+    if (!spans) {
+        log_message(LOG_ERR, "Failed to allocate trace buffer");
+        return -1;
+    }
+
+    strncpy(trace_dir, dir, sizeof(trace_dir) - 1);
+    log_message(LOG_INFO, "Writing reconcile traces to %s", trace_dir);
+    return 0;
+}
+
+void trace_cleanup(void) {
+    pthread_mutex_lock(&trace_lock);
+    free(spans);
+    spans = NULL;
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/**
+ * Open a span; detail is a printf-style description of the target
+ * Returns a handle for trace_end(), or -1 if tracing is disabled or full
+ */
+int trace_begin(const char *name, const char *format, ...) {
+    if (!spans) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    if (span_count >= TRACE_MAX_SPANS) {
+        dropped++;
+        pthread_mutex_unlock(&trace_lock);
+        return -1;
+    }
+    unsigned int index = span_count++;
+    trace_span_t *span = &spans[index];
+
+    span->name = name;
+    span->dur_us = 0;
+    span->tid = syscall(SYS_gettid);
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(span->detail, sizeof(span->detail), format, args);
+    va_end(args);
+
+    span->start_us = now_us();
+    int handle = (int)((epoch & 0x7ff) << 20 | index);
+    pthread_mutex_unlock(&trace_lock);
+
+    return handle;
+}
+
+/**
+ * Close a span opened with trace_begin()
+ */
+void trace_end(int handle) {
+    if (handle < 0) {
+        return;
+    }
+
+    uint64_t end = now_us();
+    unsigned int index = handle & 0xfffff;
+
+    pthread_mutex_lock(&trace_lock);
+    if (spans && (unsigned int)(handle >> 20) == (epoch & 0x7ff) && index < span_count) {
+        spans[index].dur_us = end - spans[index].start_us;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/**
+ * Write a JSON string body with quotes and control characters escaped
+ */
+static void write_json_string(FILE *out, const char *str) {
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            fprintf(out, "\\%c", *str);
+        } else if ((unsigned char)*str < 0x20) {
+            fprintf(out, "\\u%04x", *str);
+        } else {
+            fputc(*str, out);
+        }
+    }
+}
+
+/**
+ * Write the spans recorded since the last flush as a Chrome trace and reset
+ * Spans still open are written with their duration so far.
+ */
+void trace_flush(unsigned long generation) {
+    char path[600];
+
+    if (!spans) {
+        return;
+    }
+
+    pthread_mutex_lock(&trace_lock);
+
+    snprintf(path, sizeof(path), "%s/viod-trace-%lu.json", trace_dir, generation);
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        log_message(LOG_ERR, "Cannot write trace %s: %s", path, strerror(errno));
+    } else {
+        uint64_t end = now_us();
+        pid_t pid = getpid();
+
+        fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"viod\"}}",
+                pid);
+        for (unsigned int i = 0; i < span_count; i++) {
+            const trace_span_t *span = &spans[i];
+            uint64_t dur = span->dur_us ? span->dur_us : end - span->start_us;
+
+            fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"viod\",\"ph\":\"X\",\"ts\":%llu,"
+                    "\"dur\":%llu,\"pid\":%d,\"tid\":%d,\"args\":{\"target\":\"",
+                    span->name, (unsigned long long)span->start_us,
+                    (unsigned long long)dur, pid, span->tid);
+            write_json_string(out, span->detail);
+            fprintf(out, "\"}}");
+        }
+        fprintf(out, "\n]}\n");
+        fclose(out);
+
+        log_message(LOG_INFO, "Wrote %u trace span(s) to %s", span_count, path);
+    }
+
+    if (dropped) {
+        log_message(LOG_WARNING, "Trace buffer full, dropped %u span(s)", dropped);
+    }
+    span_count = 0;
+    dropped = 0;
+    epoch++;
+
+    pthread_mutex_unlock(&trace_lock);
+}
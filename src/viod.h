@@ -12,20 +12,36 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <fcntl.h>
 #include <dirent.h>
 #include <syslog.h>
 #include <signal.h>
 #include <sys/inotify.h>
-#include <openssl/sha.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include "inventory.h"
 
 /* Configuration constants */
 #define CONFIG_DIR "/etc/vio.d"
+#define RUNTIME_DIR "/run/viod"
+#define METRICS_PATH RUNTIME_DIR "/metrics.prom"
+#define RETRY_METRICS_PATH RUNTIME_DIR "/retries.prom"
+#define STATS_INTERVAL 10           /* Seconds between VF statistics dumps */
+#define RELOAD_DEBOUNCE_MS 500      /* Quiet period after a config change before reloading */
 #define MAX_VFS 256
 #define MAX_NAME_LEN 256
 #define MAX_LINE_LEN 1024
+#define STATE_PATH RUNTIME_DIR "/applied" /* Applied PF digests handed from --oneshot to the daemon */
+#define SHA256_DIGEST_LENGTH 32
+#define MAX_GPU_PROFILES 16         /* [profile.NAME] sections per file */
+#define MIN_MTU 68                  /* Smallest MTU accepted for PF and VF netdevs */
+#define SITE_CONFIG_PATH CONFIG_DIR "/site" /* Host-wide settings shared by all PFs */
+#define MAX_MAC_PREFIX 3            /* Fixed leading octets of generated MACs */
 
 /* Device type enumeration */
 typedef enum {
@@ -34,24 +50,108 @@ typedef enum {
     DEVICE_KIND_DEV     /**< Generic SR-IOV device */
 } device_kind_t;
 
+/* VF link state override */
+typedef enum {
+    VF_LINK_STATE_UNSET,            /**< Leave link state untouched */
+    VF_LINK_STATE_AUTO,             /**< Follow the PF uplink */
+    VF_LINK_STATE_ENABLE,           /**< Force link up */
+    VF_LINK_STATE_DISABLE           /**< Force link down */
+} vf_link_state_t;
+
+/* Per-VF on/off setting applied through the PF */
+typedef enum {
+    VF_FLAG_UNSET,                  /**< Leave the driver default */
+    VF_FLAG_ON,
+    VF_FLAG_OFF
+} vf_flag_t;
+
+/* GPU VF resource partition; -1 leaves a resource at the driver default */
+typedef struct {
+    char name[64];                  /**< Profile the values came from, empty if none */
+    long long lmem_quota;           /**< Local memory (VRAM) quota in bytes */
+    int exec_quantum_ms;            /**< Scheduling time slice */
+    int preempt_timeout_us;         /**< Preemption timeout */
+} gpu_profile_t;
+
 /* Virtual Function configuration */
 typedef struct {
     int id;                         /**< VF index (0-based) */
     char driver[MAX_NAME_LEN];      /**< Driver to bind to VF */
     char mac[18];                   /**< MAC address (network devices only) */
+    int mac_generated;              /**< mac was generated by viod, not configured */
     int vlan;                       /**< VLAN ID (network devices only) */
+    int vlan_qos;                   /**< VLAN priority (0-7) */
+    int vlan_proto;                 /**< VLAN protocol, ETH_P_8021Q or ETH_P_8021AD */
+    vf_link_state_t link_state;     /**< Link state override (network devices only) */
+    int mtu;                        /**< VF netdev MTU, 0 leaves it unchanged */
+    vf_flag_t trust;                /**< Trusted VF (promisc/multicast, MAC changes) */
+    vf_flag_t spoofchk;             /**< Source MAC/VLAN anti-spoof check */
+    vf_flag_t query_rss;            /**< Allow the VF to query the RSS hash key */
+    gpu_profile_t gpu;              /**< Resource partition (GPU devices only) */
+    char netns[MAX_NAME_LEN];       /**< Target network namespace: pid, name or path */
+    char ifname[16];                /**< VF netdev name to set, empty keeps the kernel's */
 } vf_config_t;
 
+/* PF selector: a [pf] section with one expands to every matching PF */
+typedef struct {
+    int enabled;                    /**< Set if the section is a template */
+    int vendor;                     /**< PCI vendor ID, -1 matches any */
+    int device;                     /**< PCI device ID, -1 matches any */
+    char driver[64];                /**< PF driver glob, empty matches any */
+    char ifname[64];                /**< PF netdev name glob, empty matches any */
+} pf_selector_t;
+
+/* Individually retried configuration step */
+typedef enum {
+    CONFIG_STEP_MAC,                /**< Set VF MAC via the PF */
+    CONFIG_STEP_VLAN,               /**< Set VF VLAN via the PF */
+    CONFIG_STEP_LINK_STATE,         /**< Set VF link state via the PF */
+    CONFIG_STEP_TRUST,              /**< Set VF trust via the PF */
+    CONFIG_STEP_SPOOFCHK,           /**< Set VF spoof checking via the PF */
+    CONFIG_STEP_QUERY_RSS,          /**< Set VF RSS query permission via the PF */
+    CONFIG_STEP_GPU_PROFILE,        /**< Provision GPU VF resources via the PF driver */
+    CONFIG_STEP_BIND,               /**< Bind the VF driver */
+    CONFIG_STEP_MTU,                /**< Set PF or VF netdev MTU */
+    CONFIG_STEP_NETNS,              /**< Move and/or rename the VF netdev */
+    CONFIG_STEP_PROMISC             /**< Enable promiscuous mode on the PF */
+} config_step_t;
+
 /* Physical Function configuration */
 typedef struct {
-    char name[MAX_NAME_LEN];        /**< PCI address (short or full format) */
+    char name[MAX_NAME_LEN];        /**< PCI address (short or full format, or glob) */
+    pf_selector_t match;            /**< Selector this PF was expanded from */
     device_kind_t kind;             /**< Device type */
     int num_vfs;                    /**< Number of VFs to create */
     int promisc;                    /**< Enable promiscuous mode (network devices) */
+    int mtu;                        /**< PF netdev MTU, 0 leaves it unchanged */
+    int hugepages;                  /**< Hugepages to reserve on the PF's NUMA node */
+    int hugepage_kb;                /**< Hugepage size in kB (2048 or 1048576) */
     vf_config_t vfs[MAX_VFS];       /**< VF configurations */
     char config_file[MAX_NAME_LEN]; /**< Source configuration file path */
 } pf_config_t;
 
+/* PF eswitch mode as reported by devlink */
+typedef enum {
+    ESWITCH_MODE_UNKNOWN,           /**< No devlink eswitch support */
+    ESWITCH_MODE_LEGACY,            /**< Legacy SR-IOV (per-VF attributes via PF) */
+    ESWITCH_MODE_SWITCHDEV          /**< Switchdev with representor ports */
+} eswitch_mode_t;
+
+/* Probed Physical Function capabilities */
+typedef struct {
+    char pci_addr[64];              /**< PF PCI address (full format) */
+    int present;                    /**< Device exists in sysfs */
+    int sriov_capable;              /**< Device exposes sriov_totalvfs */
+    int total_vfs;                  /**< Maximum number of VFs */
+    int num_vfs;                    /**< VFs enabled when probed */
+    unsigned int vendor;            /**< PCI vendor ID */
+    unsigned int device;            /**< PCI device ID */
+    char driver[64];                /**< Driver bound to the PF */
+    char ifname[64];                /**< PF netdev name, empty if none */
+    int numa_node;                  /**< NUMA node, -1 if not reported */
+    eswitch_mode_t eswitch_mode;    /**< devlink eswitch mode */
+} pf_caps_t;
+
 /* Dynamic list of PF configurations */
 typedef struct {
     pf_config_t *configs;           /**< Array of configurations */
@@ -59,23 +159,91 @@ typedef struct {
     size_t capacity;                /**< Allocated capacity */
 } config_list_t;
 
+/* Host-wide settings from SITE_CONFIG_PATH */
+typedef struct {
+    char mac_salt[64];              /**< Mixed into generated MACs, empty for none */
+    unsigned char mac_prefix[MAX_MAC_PREFIX]; /**< Leading octets of generated MACs */
+    int mac_prefix_len;             /**< Octets used in mac_prefix */
+} site_config_t;
+
 /* Function declarations */
 
 /* Configuration management */
 int parse_config_file(const char *filename, pf_config_t *config);
 int load_all_configs(config_list_t *configs);
 void cleanup_configs(config_list_t *configs);
+const char *vf_link_state_name(vf_link_state_t state);
+const char *vf_flag_name(vf_flag_t flag);
 
 /* SR-IOV operations */
 int apply_all_configs(config_list_t *configs);
-int create_vfs(pf_config_t *config);
-int configure_vf(pf_config_t *pf_config, vf_config_t *vf_config);
+int create_vfs(const pf_config_t *config);
+int configure_vf(const pf_config_t *pf_config, const vf_config_t *vf_config);
+int run_config_step(const pf_config_t *pf_config, const vf_config_t *vf_config, config_step_t step);
+const char *config_step_name(config_step_t step);
+int config_step_prerequisite(const vf_config_t *vf_config, config_step_t step);
+void resolve_vf_mac(const pf_config_t *pf_config, const vf_config_t *vf_config, char *mac);
+void publish_vf(const pf_config_t *pf_config, const vf_config_t *vf_config, inventory_state_t state);
+
+/* Retry scheduler */
+void retry_schedule(const pf_config_t *pf_config, int vf_id, config_step_t step);
+void retry_clear_pf(const char *pf_name);
+void retry_prune(const config_list_t *configs);
+int retry_pending(const char *pf_name, int vf_id);
+int retry_step_pending(const char *pf_name, int vf_id, config_step_t step);
+int retry_pending_pf(const char *pf_name);
+long retry_next_delay_ms(void);
+void retry_run_due(config_list_t *configs);
+void retry_export(void);
+void retry_cleanup(void);
+
+/* PF capability probe */
+int probe_pf(const char *pf_name, pf_caps_t *caps);
+int pci_scan_pfs(pf_caps_t **pfs, size_t *count);
+void probe_invalidate(const char *pci_addr);
+void probe_cleanup(void);
+const char *eswitch_mode_name(eswitch_mode_t mode);
+int driver_available(const char *driver);
+int validate_pf_config(const pf_config_t *config);
+int uevent_open(void);
+void uevent_handle(int fd);
+
+/* NUMA and vfio preparation */
+int pci_numa_node(const char *pci_addr);
+int pci_iommu_group(const char *pci_addr);
+int iommu_enabled(void);
+int hugepage_size_supported(int page_kb);
+int vfio_group_viable(const char *vf_pci_addr);
+void reserve_hugepages(const pf_config_t *const *configs, size_t count);
+
+/* Reconcile worker */
+int reconcile_start(void);
+void reconcile_stop(void);
+void reconcile_submit(config_list_t *configs);
+int reconcile_needed(const pf_config_t *config);
+int reconcile_cancelled(const pf_config_t *config);
+void reconcile_done(const pf_config_t *config, int result);
+void reconcile_invalidate(const char *pf_name);
+int reconcile_oneshot(config_list_t *configs);
 
 /* Network device operations */
-int enable_promiscuous_mode(const char *interface);
+int enable_promiscuous_mode(const char *pci_addr);
 int set_vf_mac(const char *pf_name, int vf_id, const char *mac);
-int set_vf_vlan(const char *pf_name, int vf_id, int vlan);
-void generate_stable_mac(const char *pf_pci_addr, int vf_id, char *mac_addr);
+int set_vf_vlan(const char *pf_name, int vf_id, int vlan, int qos, int proto);
+int set_vf_link_state(const char *pf_name, int vf_id, vf_link_state_t state);
+int set_vf_flag(const char *pf_name, int vf_id, int attr, vf_flag_t flag);
+int set_pci_mtu(const char *pci_addr, int mtu);
+int move_pci_netdev(const char *pci_addr, const char *netns, const char *ifname);
+void sha256(const void *data, size_t len, unsigned char *hash);
+
+/* MAC address index */
+void generate_stable_mac(const char *pf_pci_addr, int vf_id, const site_config_t *site,
+                         int attempt, char *mac_addr);
+int mac_index_build(config_list_t *configs, const site_config_t *site);
+
+/* GPU VF provisioning */
+int gpu_profile_set(const gpu_profile_t *gpu);
+int apply_gpu_profile(const char *pf_pci_addr, int vf_id, const gpu_profile_t *gpu);
 
 /* Driver management */
 int bind_vf_driver(const char *pci_addr, const char *driver);
@@ -84,8 +252,47 @@ int bind_vf_driver(const char *pci_addr, const char *driver);
 int get_vf_pci_address(const char *pf_name, int vf_id, char *vf_pci_addr, size_t addr_size);
 int get_pf_pci_address(const char *pf_name, char *pf_pci_addr, size_t addr_size);
 int normalize_pci_address(const char *input_addr, char *normalized_addr, size_t addr_size);
+int get_pci_interface(const char *pci_addr, char *interface_name, size_t name_size);
+
+/* rtnetlink helpers */
+typedef void (*nl_dump_cb_t)(struct nlmsghdr *nlh, void *ctx);
+int nl_open(int protocol);
+struct nlmsghdr *nl_msg_init(void *buf, size_t size, int type, int flags, size_t hdr_len);
+int nl_attr_put(struct nlmsghdr *nlh, size_t size, int type, const void *data, size_t len);
+int nl_attr_put_u32(struct nlmsghdr *nlh, size_t size, int type, uint32_t value);
+int nl_attr_put_str(struct nlmsghdr *nlh, size_t size, int type, const char *value);
+struct rtattr *nl_nest_begin(struct nlmsghdr *nlh, size_t size, int type);
+void nl_nest_end(struct nlmsghdr *nlh, struct rtattr *nest);
+int nl_request(int fd, struct nlmsghdr *nlh, nl_dump_cb_t callback, void *ctx);
+int nl_transact(int fd, struct nlmsghdr *nlh);
+int nl_dump(int fd, struct nlmsghdr *nlh, nl_dump_cb_t callback, void *ctx);
+void nl_parse_attrs(struct rtattr *tb[], int max, struct rtattr *rta, int len);
+int get_pci_ifindex(const char *pci_addr);
+
+/* VF statistics export */
+int stats_open(void);
+void stats_close(void);
+size_t stats_set_targets(const config_list_t *configs);
+int stats_collect(void);
+
+/* Reconcile timeline tracing */
+int trace_init(void);
+void trace_cleanup(void);
+int trace_begin(const char *name, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+void trace_end(int handle);
+void trace_flush(unsigned long generation);
+
+/* Shared-memory VF inventory */
+int inventory_open(void);
+void inventory_close(void);
+void inventory_clear_pf(const char *pf_name);
+void inventory_retain(int (*keep)(const char *pf_pci_addr));
+void inventory_update_vf(const pf_config_t *pf_config, const vf_config_t *vf_config,
+                         const char *mac, inventory_state_t state);
 
 /* Logging */
+void log_init(int use_syslog);
 void log_message(int priority, const char *format, ...);
 
 #endif // VIOD_H